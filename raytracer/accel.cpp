@@ -0,0 +1,245 @@
+//
+//  accel.cpp
+//  raytracer
+//
+//  Created by ambling on 13-5-20.
+//  Copyright (c) 2013年 ambling. All rights reserved.
+//
+
+#include <limits>
+#include "accel.h"
+#include "model.h"
+#include "raytracer.h"
+#include "simd.h"
+
+using namespace std;
+using namespace raytracer;
+
+
+// the default any-hit query runs the closest-hit search
+bool AmAccelerator::occluded(const AmRay &ray, float tmax, int ignore) const
+{
+    int index = -1;
+    float hit = search(ray, index);
+    return (index != ignore && hit > EPSILON && hit < tmax);
+}
+
+void AmAccelerator::searchPacket(const AmRayPacket &packet,
+                                 float *hits, int *indices) const
+{
+    for (int i = 0; i < packet.size; i++) {
+        hits[i] = search(packet.ray(i), indices[i]);
+    }
+}
+
+
+////////////// triangle buffer /////////////////////
+
+void AmTriangleBuffer::clear()
+{
+    AmArray<float> *arrays[] = {&v0x, &v0y, &v0z, &e1x, &e1y, &e1z,
+                                &e2x, &e2y, &e2z};
+    for (int i = 0; i < 9; i++) {
+        arrays[i]->clear();
+    }
+    meshes.clear();
+}
+
+void AmTriangleBuffer::reserve(size_t n)
+{
+    AmArray<float> *arrays[] = {&v0x, &v0y, &v0z, &e1x, &e1y, &e1z,
+                                &e2x, &e2y, &e2z};
+    for (int i = 0; i < 9; i++) {
+        arrays[i]->reserve(n);
+    }
+    meshes.reserve(n);
+}
+
+void AmTriangleBuffer::append(const AmModel &model, int mesh)
+{
+    const unsigned int *vindices = model.mTriangles[mesh].vindices;
+    const AmVec3f &a = model.mVertices[vindices[0]];
+    AmVec3f e1 = model.mVertices[vindices[1]] - a;
+    AmVec3f e2 = model.mVertices[vindices[2]] - a;
+    v0x.push_back(a.x());
+    v0y.push_back(a.y());
+    v0z.push_back(a.z());
+    e1x.push_back(e1.x());
+    e1y.push_back(e1.y());
+    e1z.push_back(e1.z());
+    e2x.push_back(e2.x());
+    e2y.push_back(e2.y());
+    e2z.push_back(e2.z());
+    meshes.push_back(mesh);
+}
+
+void AmTriangleBuffer::pad(size_t width)
+{
+    AmArray<float> *arrays[] = {&v0x, &v0y, &v0z, &e1x, &e1y, &e1z,
+                                &e2x, &e2y, &e2z};
+    while (meshes.size() % width != 0) {
+        // both edges are 0, so the determinant is 0
+        for (int i = 0; i < 9; i++) {
+            arrays[i]->push_back(0);
+        }
+        meshes.push_back(-1);
+    }
+}
+
+#if AM_SIMD_WIDTH > 1
+// the ray, one value in all the lanes
+struct AmRayVector
+{
+    AmFloatV ox, oy, oz, dx, dy, dz;
+    
+    AmRayVector(const AmRay &ray)
+    {
+        ox = vSet1(ray.orig.mData[0]);
+        oy = vSet1(ray.orig.mData[1]);
+        oz = vSet1(ray.orig.mData[2]);
+        dx = vSet1(ray.dir.mData[0]);
+        dy = vSet1(ray.dir.mData[1]);
+        dz = vSet1(ray.dir.mData[2]);
+    }
+};
+
+// the same steps as AmTriangleBuffer::hit() on the triangles
+//  [i, i + AM_SIMD_WIDTH): the lanes which fail a test are masked off
+//  instead of returning early. Return the mask of the hits farther
+//  than EPSILON and their distances in t
+static inline AmFloatV hitVector(const AmTriangleBuffer &b, size_t i,
+                                 const AmRayVector &r, AmFloatV &t)
+{
+    const AmFloatV zero = vSet1(0), one = vSet1(1);
+    AmFloatV ax = vLoad(&b.e1x[i]), ay = vLoad(&b.e1y[i]), az = vLoad(&b.e1z[i]);
+    AmFloatV bx = vLoad(&b.e2x[i]), by = vLoad(&b.e2y[i]), bz = vLoad(&b.e2z[i]);
+    
+    // p = d x e2
+    AmFloatV px = vSub(vMul(r.dy, bz), vMul(r.dz, by));
+    AmFloatV py = vSub(vMul(r.dz, bx), vMul(r.dx, bz));
+    AmFloatV pz = vSub(vMul(r.dx, by), vMul(r.dy, bx));
+    AmFloatV det = vAdd(vAdd(vMul(ax, px), vMul(ay, py)), vMul(az, pz));
+    AmFloatV inv = vDiv(one, det);
+    
+    AmFloatV tx = vSub(r.ox, vLoad(&b.v0x[i]));
+    AmFloatV ty = vSub(r.oy, vLoad(&b.v0y[i]));
+    AmFloatV tz = vSub(r.oz, vLoad(&b.v0z[i]));
+    AmFloatV u = vMul(vAdd(vAdd(vMul(tx, px), vMul(ty, py)),
+                           vMul(tz, pz)), inv);
+    
+    // q = t x e1
+    AmFloatV qx = vSub(vMul(ty, az), vMul(tz, ay));
+    AmFloatV qy = vSub(vMul(tz, ax), vMul(tx, az));
+    AmFloatV qz = vSub(vMul(tx, ay), vMul(ty, ax));
+    AmFloatV v = vMul(vAdd(vAdd(vMul(r.dx, qx), vMul(r.dy, qy)),
+                           vMul(r.dz, qz)), inv);
+    t = vMul(vAdd(vAdd(vMul(bx, qx), vMul(by, qy)), vMul(bz, qz)), inv);
+    
+    return vAnd(vAnd(vNE(det, zero), vGT(t, vSet1(EPSILON))),
+                vAnd(vAnd(vGE(u, zero), vLE(u, one)),
+                     vAnd(vGE(v, zero), vLE(vAdd(u, v), one))));
+}
+#endif
+
+float AmTriangleBuffer::nearest(size_t first, size_t end, const AmRay &ray,
+                                size_t &slot) const
+{
+    float minHit = -1;
+    size_t i = first;
+    
+#if AM_SIMD_WIDTH > 1
+    const AmRayVector r(ray);
+    const AmFloatV inf = vSet1(numeric_limits<float>::max());
+    for (; i + AM_SIMD_WIDTH <= end; i += AM_SIMD_WIDTH) {
+        AmFloatV t;
+        AmFloatV mask = hitVector(*this, i, r, t);
+        if (vMask(mask) == 0) {
+            continue;
+        }
+        
+        // nearest lane of this vector, the first one on a tie
+        AmFloatV hits = vSelect(mask, t, inf);
+        AmFloatV least = vHMin(hits);
+        float hit = vFirst(least);
+        if (minHit < 0 || hit < minHit) {
+            minHit = hit;
+            slot = i + vFirstLane(vMask(vEQ(hits, least)));
+        }
+    }
+#endif
+    
+    // the rest which doesn't fill a vector
+    for (; i < end; i++) {
+        float t = hit(i, ray);
+        if (t > EPSILON && (minHit < 0 || t < minHit)) {
+            minHit = t;
+            slot = i;
+        }
+    }
+    return minHit;
+}
+
+bool AmTriangleBuffer::any(size_t first, size_t end, const AmRay &ray,
+                           float tmax, int ignore) const
+{
+    size_t i = first;
+    
+#if AM_SIMD_WIDTH > 1
+    const AmRayVector r(ray);
+    const AmFloatV limit = vSet1(tmax);
+    for (; i + AM_SIMD_WIDTH <= end; i += AM_SIMD_WIDTH) {
+        AmFloatV t;
+        AmFloatV hits = hitVector(*this, i, r, t);
+        int mask = vMask(vAnd(hits, vLT(t, limit)));
+        // rarely more than one lane, check the ignored mesh one by one
+        for (int lane = 0; mask != 0; lane++, mask >>= 1) {
+            if ((mask & 1) && meshes[i + lane] != ignore) {
+                return true;
+            }
+        }
+    }
+#endif
+    
+    for (; i < end; i++) {
+        if (meshes[i] == ignore) {
+            continue;
+        }
+        float t = hit(i, ray);
+        if (t > EPSILON && t < tmax) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+////////////// brute force /////////////////////
+
+void AmBruteForce::init()
+{
+    triangles.clear();
+    triangles.reserve(model->mTriangles.size());
+    for (unsigned int i = 0; i < model->mTriangles.size(); i++) {
+        triangles.append(*model, i);
+    }
+    triangles.pad(AM_SIMD_WIDTH);
+}
+
+// get the hit point of the ray and the model,
+// as well as the index of the mesh, return -1 if there is no intersection
+float AmBruteForce::search(const AmRay &ray, int &index) const
+{
+    // iterate all the meshes
+    AmCounters::count(AmCounters::AM_TRIANGLE_TESTS, triangles.size());
+    size_t slot = 0;
+    float mindis = triangles.nearest(0, triangles.size(), ray, slot);
+    index = (mindis > 0) ? triangles.meshes[slot] : -1;
+    return mindis;
+}
+
+// stop at the first mesh that blocks the ray
+bool AmBruteForce::occluded(const AmRay &ray, float tmax, int ignore) const
+{
+    AmCounters::count(AmCounters::AM_TRIANGLE_TESTS, triangles.size());
+    return triangles.any(0, triangles.size(), ray, tmax, ignore);
+}
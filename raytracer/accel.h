@@ -0,0 +1,246 @@
+//
+//  accel.h
+//  raytracer
+//
+//  interface of the acceleration structures that find the meshes
+//  hit by a ray
+//
+//  Created by ambling on 13-5-20.
+//  Copyright (c) 2013年 ambling. All rights reserved.
+//
+
+#ifndef raytracer_accel_h
+#define raytracer_accel_h
+
+#include "utils.h"
+#include "array.h"
+#include "stats.h"
+
+using namespace std;
+
+namespace raytracer {
+    
+    
+    /*
+     * ray info
+     */
+    class AmRay
+    {
+    public:
+        AmVec3f orig;
+        AmVec3f dir;
+        AmVec3f invDir;     // 1 / dir, infinite on a zero component
+        int     sign[3];    // 1 where invDir is negative
+        
+        AmRay(const AmVec3f &o, const AmVec3f &d)
+            :orig(o), dir(d)
+        {
+            prepare();
+        }
+        
+        // the ray through the point (w, h) of the image plane, pixel
+        //  [w, h] covers [w, w + 1) x [h, h + 1)
+        AmRay(const AmCameraPtr &camera, float w, float h);
+        
+        // compute invDir and sign from dir, once per ray instead of on
+        //  every node of the traversal
+        void prepare()
+        {
+            for (int axis = 0; axis < 3; axis++) {
+                invDir.mData[axis] = 1.0f / dir.mData[axis];
+                // from invDir, so -0 counts as negative like its -inf
+                sign[axis] = (invDir.mData[axis] < 0) ? 1 : 0;
+            }
+        }
+        
+        bool operator == (AmRay &rhs)
+        {
+            return (orig == rhs.orig && dir == rhs.dir);
+        }
+        
+    };
+    
+    /*
+     * rays of neighbouring pixels traced together, in structure of arrays
+     *  layout so a vector of rays can be loaded along one axis
+     */
+    class AmRayPacket
+    {
+    public:
+        static const int MAX_SIZE = 16;     // 4x4 pixels
+        
+        int     size;
+        float   orig[3][MAX_SIZE];
+        float   dir[3][MAX_SIZE];
+        
+        AmRayPacket()
+            :size(0)
+        {}
+        
+        // the first ray is copied to all the slots, so the slots after
+        //  the last ray hold a real ray too and can be loaded in a vector
+        //  without garbage (which may be slow denormals)
+        void push(const AmRay &ray)
+        {
+            int end = (size == 0) ? MAX_SIZE : size + 1;
+            for (int i = size; i < end; i++) {
+                for (int axis = 0; axis < 3; axis++) {
+                    orig[axis][i] = ray.orig.mData[axis];
+                    dir[axis][i] = ray.dir.mData[axis];
+                }
+            }
+            size++;
+        }
+        
+        AmRay ray(int i) const
+        {
+            return AmRay(AmVec3f(orig[0][i], orig[1][i], orig[2][i]),
+                         AmVec3f(dir[0][i], dir[1][i], dir[2][i]));
+        }
+    };
+    
+    /*
+     * triangles prepared for the Möller–Trumbore test, in structure of
+     *  arrays layout: the first vertex and the two edges from it.
+     *  The accelerators fill it in the order their leaves visit the
+     *  triangles, so a leaf is a contiguous range. The arrays may view
+     *  a mapped cache file, see AmKDTree::load()
+     */
+    class AmTriangleBuffer
+    {
+    public:
+        AmArray<float>  v0x, v0y, v0z;  // first vertex
+        AmArray<float>  e1x, e1y, e1z;  // second vertex - first vertex
+        AmArray<float>  e2x, e2y, e2z;  // third vertex - first vertex
+        AmArray<int>    meshes;         // index of the triangle in the model
+        
+        size_t size() const
+        {
+            return meshes.size();
+        }
+        
+        void clear();
+        void reserve(size_t n);
+        
+        // append triangle mesh of the model
+        void append(const AmModel &model, int mesh);
+        
+        // append degenerate triangles (mesh -1, never hit) until the size
+        //  is a multiple of width, so the next range starts on a full
+        //  vector of AM_SIMD_WIDTH triangles
+        void pad(size_t width);
+        
+        size_t bytes() const
+        {
+            return meshes.size() * (9 * sizeof(float) + sizeof(int));
+        }
+        
+        // distance along the ray to triangle i, -1 if it is missed
+        float hit(size_t i, const AmRay &ray) const
+        {
+            const AmVec3f &d = ray.dir;
+            // p = d x e2
+            float px = d.mData[1] * e2z[i] - d.mData[2] * e2y[i];
+            float py = d.mData[2] * e2x[i] - d.mData[0] * e2z[i];
+            float pz = d.mData[0] * e2y[i] - d.mData[1] * e2x[i];
+            float det = e1x[i] * px + e1y[i] * py + e1z[i] * pz;
+            if (det == 0) {
+                return -1;  // parallel to the triangle
+            }
+            float inv = 1.0f / det;
+            
+            float tx = ray.orig.mData[0] - v0x[i];
+            float ty = ray.orig.mData[1] - v0y[i];
+            float tz = ray.orig.mData[2] - v0z[i];
+            float u = (tx * px + ty * py + tz * pz) * inv;
+            if (u < 0 || u > 1) {
+                return -1;
+            }
+            
+            // q = t x e1
+            float qx = ty * e1z[i] - tz * e1y[i];
+            float qy = tz * e1x[i] - tx * e1z[i];
+            float qz = tx * e1y[i] - ty * e1x[i];
+            float v = (d.mData[0] * qx + d.mData[1] * qy + d.mData[2] * qz) * inv;
+            if (v < 0 || u + v > 1) {
+                return -1;
+            }
+            return (e2x[i] * qx + e2y[i] * qy + e2z[i] * qz) * inv;
+        }
+        
+        // closest hit in [first, end), AM_SIMD_WIDTH triangles per step:
+        //  return the distance, or -1 if nothing is hit, and the position
+        //  of the triangle in the buffer. Ties go to the lower position
+        float nearest(size_t first, size_t end, const AmRay &ray,
+                      size_t &slot) const;
+        
+        // any hit in [first, end): true if a triangle of a mesh other
+        //  than ignore is hit between EPSILON and tmax
+        bool  any(size_t first, size_t end, const AmRay &ray,
+                  float tmax, int ignore) const;
+    };
+    
+    
+    /*
+     * interface of an acceleration structure
+     */
+    class AmAccelerator
+    {
+    protected:
+        AmModelPtr  model;
+        
+    public:
+        // the available acceleration structures
+        enum AmType{AM_BRUTE_FORCE, AM_KDTREE, AM_BVH};
+        
+        virtual ~AmAccelerator()
+        {}
+        
+        void setModel(const AmModelPtr &m)
+        {
+            model = m;
+        }
+        
+        // build the structure from the model
+        virtual void    init() = 0;
+        
+        // closest hit: return the distance along the ray, or -1 if nothing
+        //  is hit, and the index of the mesh.
+        //  Read-only, so it is safe to call from several render threads
+        virtual float   search(const AmRay &ray, int &index) const = 0;
+        
+        // closest hit of every ray of the packet, the same results as
+        //  search(). The default traces the rays one by one
+        virtual void    searchPacket(const AmRayPacket &packet,
+                                     float *hits, int *indices) const;
+        
+        // any hit: true if a mesh other than ignore is hit between
+        //  EPSILON and tmax
+        virtual bool    occluded(const AmRay &ray, float tmax,
+                                 int ignore) const;
+        
+        // print the size of the structure
+        virtual void    report(ostream &) const
+        {}
+    };
+    typedef shared_ptr<AmAccelerator> AmAcceleratorPtr;
+    
+    
+    /*
+     * no acceleration, test the ray against every mesh
+     */
+    class AmBruteForce : public AmAccelerator
+    {
+        AmTriangleBuffer    triangles;  // in the order of the model
+        
+    public:
+        void    init();
+        
+        float   search(const AmRay &ray, int &index) const;
+        bool    occluded(const AmRay &ray, float tmax, int ignore) const;
+    };
+    
+}
+
+
+#endif
@@ -0,0 +1,159 @@
+//
+//  array.h
+//  raytracer
+//
+//  AmArray: the elements of a model array, either owned in a vector or
+//  viewed in place in memory owned by someone else (a mapped scene file).
+//  Reads cost the same as a vector; the first change to the size of a
+//  view copies its elements into the vector.
+//
+//  Created by ambling on 13-5-28.
+//  Copyright (c) 2013年 ambling. All rights reserved.
+//
+
+#ifndef raytracer_array_h
+#define raytracer_array_h
+
+#include <vector>
+
+using namespace std;
+
+namespace raytracer {
+
+    template <class T>
+    class AmArray
+    {
+        vector<T>   mVector;    // the elements when they are owned
+        T           *mData;     // the first element, in mVector or the view
+        size_t      mSize;
+        bool        mView;
+
+        void sync()
+        {
+            mData = mVector.empty() ? 0 : &mVector[0];
+            mSize = mVector.size();
+        }
+
+        // copy the viewed elements before changing them
+        void own()
+        {
+            if (mView) {
+                mVector.assign(mData, mData + mSize);
+                mView = false;
+                sync();
+            }
+        }
+
+    public:
+        AmArray()
+            :mData(0), mSize(0), mView(false)
+        {}
+
+        AmArray(const AmArray &rhs)
+            :mVector(rhs.mVector), mData(rhs.mData), mSize(rhs.mSize),
+            mView(rhs.mView)
+        {
+            if (!mView) {
+                sync();
+            }
+        }
+
+        AmArray(AmArray &&rhs) noexcept
+            :mVector(std::move(rhs.mVector)), mData(rhs.mData),
+            mSize(rhs.mSize), mView(rhs.mView)
+        {
+            rhs.mData = 0;
+            rhs.mSize = 0;
+            rhs.mView = false;
+        }
+
+        AmArray &operator = (AmArray rhs)
+        {
+            swap(mVector, rhs.mVector);
+            swap(mData, rhs.mData);
+            swap(mSize, rhs.mSize);
+            swap(mView, rhs.mView);
+            return *this;
+        }
+
+        // view n elements at data, which must outlive the array
+        void view(T *data, size_t n)
+        {
+            vector<T>().swap(mVector);
+            mData = n ? data : 0;
+            mSize = n;
+            mView = true;
+        }
+
+        bool isView() const
+        {
+            return mView;
+        }
+
+        size_t size() const
+        {
+            return mSize;
+        }
+
+        bool empty() const
+        {
+            return mSize == 0;
+        }
+
+        T &operator[] (size_t i)
+        {
+            return mData[i];
+        }
+
+        const T &operator[] (size_t i) const
+        {
+            return mData[i];
+        }
+
+        T *data()
+        {
+            return mData;
+        }
+
+        const T *data() const
+        {
+            return mData;
+        }
+
+        T &back()
+        {
+            return mData[mSize - 1];
+        }
+
+        void push_back(const T &value)
+        {
+            own();
+            mVector.push_back(value);
+            sync();
+        }
+
+        void reserve(size_t n)
+        {
+            own();
+            mVector.reserve(n);
+            sync();
+        }
+
+        void resize(size_t n, const T &value = T())
+        {
+            own();
+            mVector.resize(n, value);
+            sync();
+        }
+
+        void clear()
+        {
+            vector<T>().swap(mVector);
+            mView = false;
+            sync();
+        }
+    };
+
+}
+
+#endif
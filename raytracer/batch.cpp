@@ -0,0 +1,225 @@
+//
+//  batch.cpp
+//  raytracer
+//
+//  headless renderer: load a model, render one frame without GLUT
+//  and write it to a PPM or PNG file
+//
+//  Created by ambling on 13-5-14.
+//  Copyright (c) 2013年 ambling. All rights reserved.
+//
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include "utils.h"
+#include "model.h"
+#include "raytracer.h"
+#include "image.h"
+
+using namespace raytracer;
+
+static void usage(const char *name)
+{
+    cerr<<"usage: "<<name<<" [options] model.obj"<<endl
+        <<"  -o file          output image, .ppm or .png (default out.ppm)"<<endl
+        <<"  -size WxH        resolution (default 800x600)"<<endl
+        <<"  -eye x,y,z       camera position (default 0,0,2)"<<endl
+        <<"  -center x,y,z    camera target (default 0,0,0)"<<endl
+        <<"  -up x,y,z        camera up vector (default 0,1,0)"<<endl
+        <<"  -angle a         camera view angle (default 45)"<<endl
+        <<"  -light x,y,z     add a positional light (default 1,0,2)"<<endl
+        <<"  -ambient r,g,b,a add an ambient light (default 1,1,1,1)"<<endl
+        <<"  -threads n       render and parse threads, 0 for all cores"<<endl
+        <<"                   (default 0)"<<endl
+        <<"  -depth d         maximum recursion depth (default 3)"<<endl
+        <<"  -accel a         kdtree, bvh or brute (default kdtree)"<<endl
+        <<"  -kdtree h        kd-tree builder, median or sah (default median)"<<endl
+        <<"  -packet n        trace primary rays in n x n packets, 1, 2 or 4"<<endl
+        <<"                   (default 4)"<<endl
+        <<"  -aa n            antialias the edges with up to n rays per pixel,"<<endl
+        <<"                   4 or 16 (default 1, none)"<<endl
+        <<"  -cache dir       load the kd-tree from dir, or save it there"<<endl
+        <<"  -memory mb       memory limit of the model while loading it"<<endl
+        <<"  -weld tol        merge the vertices closer than tol, in the"<<endl
+        <<"                   unit cube the model is scaled to"<<endl;
+}
+
+// parse "x,y,z" (or "x,y,z,w" when n is 4)
+static bool parseFloats(const char *str, float *v, int n)
+{
+    if (n == 4) {
+        return sscanf(str, "%f,%f,%f,%f", &v[0], &v[1], &v[2], &v[3]) == 4;
+    }
+    return sscanf(str, "%f,%f,%f", &v[0], &v[1], &v[2]) == 3;
+}
+
+int main(int argc, char * argv[])
+{
+    string path, output("out.ppm"), cacheDir;
+    int width = 800, height = 600, memory = 0;
+    float weld = -1;
+    int threads = 0, depth = 3, packet = 4, samples = 1;
+    AmAccelerator::AmType accel = AmAccelerator::AM_KDTREE;
+    AmKDTree::AmHeuristic heuristic = AmKDTree::AM_MEDIAN;
+    float angle = 45;
+    float eye[3] = {0, 0, 2}, center[3] = {0, 0, 0}, up[3] = {0, 1, 0};
+    vector<AmLightPtr> lights;
+    int lightName = AmLight::AM_LIGHT0;
+    bool hasPosition = false, hasAmbient = false;
+
+    for (int i = 1; i < argc; i++) {
+        string arg(argv[i]);
+        bool more = (i + 1 < argc);
+        bool ok = true;
+
+        if (arg == "-o" && more) {
+            output = argv[++i];
+        } else if (arg == "-size" && more) {
+            ok = (sscanf(argv[++i], "%dx%d", &width, &height) == 2
+                  && width > 0 && height > 0);
+        } else if (arg == "-eye" && more) {
+            ok = parseFloats(argv[++i], eye, 3);
+        } else if (arg == "-center" && more) {
+            ok = parseFloats(argv[++i], center, 3);
+        } else if (arg == "-up" && more) {
+            ok = parseFloats(argv[++i], up, 3);
+        } else if (arg == "-angle" && more) {
+            angle = atof(argv[++i]);
+        } else if ((arg == "-light" || arg == "-ambient") && more) {
+            float value[4] = {0, 0, 0, 1};
+            bool ambient = (arg == "-ambient");
+            ok = parseFloats(argv[++i], value, ambient ? 4 : 3);
+            lights.push_back(AmLightPtr(new AmLight(
+                        ambient ? AmLight::AM_AMBIENT : AmLight::AM_POSITION,
+                        static_cast<AmLight::GL_NAME>(lightName++), value)));
+            hasAmbient = hasAmbient || ambient;
+            hasPosition = hasPosition || !ambient;
+        } else if (arg == "-threads" && more) {
+            threads = atoi(argv[++i]);
+        } else if (arg == "-depth" && more) {
+            depth = atoi(argv[++i]);
+        } else if (arg == "-accel" && more) {
+            string name(argv[++i]);
+            ok = (name == "kdtree" || name == "bvh" || name == "brute");
+            if (name == "bvh") {
+                accel = AmAccelerator::AM_BVH;
+            } else if (name == "brute") {
+                accel = AmAccelerator::AM_BRUTE_FORCE;
+            }
+        } else if (arg == "-kdtree" && more) {
+            string name(argv[++i]);
+            ok = (name == "median" || name == "sah");
+            heuristic = (name == "sah") ? AmKDTree::AM_SAH : AmKDTree::AM_MEDIAN;
+        } else if (arg == "-packet" && more) {
+            packet = atoi(argv[++i]);
+            ok = (packet == 1 || packet == 2 || packet == 4);
+        } else if (arg == "-aa" && more) {
+            samples = atoi(argv[++i]);
+            ok = (samples == 1 || samples == 4 || samples == 16);
+        } else if (arg == "-cache" && more) {
+            cacheDir = argv[++i];
+        } else if (arg == "-memory" && more) {
+            memory = atoi(argv[++i]);
+        } else if (arg == "-weld" && more) {
+            weld = static_cast<float>(atof(argv[++i]));
+        } else if (arg[0] != '-' && path.empty()) {
+            path = arg;
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            cerr<<"bad argument: "<<arg<<endl;
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (path.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // the same lights as the viewer if none is given
+    if (!hasPosition) {
+        float light_position[] = { 1.0, 0.0, 2.0, 0.0 };
+        lights.push_back(AmLightPtr(new AmLight(
+                            AmLight::AM_POSITION,
+                            static_cast<AmLight::GL_NAME>(lightName++),
+                            light_position)));
+    }
+    if (!hasAmbient) {
+        float light_ambient[] = { 1.0, 1.0, 1.0, 1.0 };
+        lights.push_back(AmLightPtr(new AmLight(
+                            AmLight::AM_AMBIENT,
+                            static_cast<AmLight::GL_NAME>(lightName++),
+                            light_ambient)));
+    }
+
+    AmCameraPtr camera(new AmCamera(width, height, angle,
+                                    AmVec3f(eye[0], eye[1], eye[2]),
+                                    AmVec3f(center[0], center[1], center[2]),
+                                    AmVec3f(up[0], up[1], up[2])));
+    AmRayTracerPtr rayTracer(new AmRayTracer());
+    rayTracer->setCamera(camera);
+    rayTracer->setLight(lights);
+    rayTracer->setMaxDepth(depth);
+    rayTracer->setThreads(threads);
+    rayTracer->setAccelerator(accel);
+    rayTracer->setKDTreeHeuristic(heuristic);
+    rayTracer->setPacketSize(packet);
+    rayTracer->setSamples(samples);
+    rayTracer->setCacheDir(cacheDir);
+
+    AmTimer timer;
+    // the file is parsed by as many threads as the rendering, the
+    //  raytracer doesn't use the vertex normals and texcoords
+    AmLoadOptions options(threads > 0 ? threads :
+                          AmThreadPool::hardwareThreads());
+    options.normals = options.texcoords = false;
+    options.memoryLimit = static_cast<size_t>(memory) << 20;
+    AmModelPtr model(new AmModel(path, options));
+    if (model->mTriangles.size() == 0) {
+        cerr<<"no triangles in model: "<<path<<endl;
+        return 1;
+    }
+    double parseTime = timer.elapsed();
+
+    timer.reset();
+    model->utilize();
+    if (weld >= 0) {
+        model->weld(weld);
+    }
+    double utilizeTime = timer.elapsed();
+
+    timer.reset();
+    rayTracer->setModel(model);
+    double buildTime = timer.elapsed();
+
+    // an array, so it needs the array deleter
+    AmUintPtr pixels(new unsigned int[width * height],
+                     default_delete<unsigned int[]>());
+    timer.reset();
+    rayTracer->render(pixels);
+    double renderTime = timer.elapsed();
+
+    if (!AmImage::write(output, pixels.get(), width, height)) {
+        cerr<<"can't write image: "<<output<<endl;
+        return 1;
+    }
+
+    cout<<"triangles: "<<model->mTriangles.size()<<endl;
+    cout<<"parse:     "<<parseTime<<" s"<<endl;
+    cout<<"utilize:   "<<utilizeTime<<" s"<<endl;
+    cout<<"build:     "<<buildTime<<" s"<<endl;
+    cout<<"render:    "<<renderTime<<" s"<<endl;
+    if (samples > 1) {
+        cout<<"antialiased: "<<rayTracer->getRefined()<<" pixels"<<endl;
+    }
+    model->report(cout);
+    rayTracer->getAccelerator()->report(cout);
+    rayTracer->getStats().report(cout);
+    return 0;
+}
@@ -0,0 +1,424 @@
+//
+//  bench.cpp
+//  raytracer
+//
+//  benchmark over the models in obj/: every scene has a fixed camera and
+//  light, is loaded, utilized, built and rendered several times, and the
+//  median times, rays/s and peak memory are written to a JSON file. Each
+//  scene runs in a child process, so its memory is its own. With
+//  a baseline file written by an earlier run, the regressions above the
+//  threshold are reported and the exit status is 2
+//
+//  Created by ambling on 13-6-3.
+//  Copyright (c) 2013年 ambling. All rights reserved.
+//
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "utils.h"
+#include "model.h"
+#include "raytracer.h"
+
+using namespace raytracer;
+
+/*
+ * a model of the suite and the view it is rendered from, the models are
+ *  scaled into the unit cube by utilize
+ */
+class AmBenchScene
+{
+public:
+    const char  *name;
+    const char  *path;      // relative to the obj directory
+    float       eye[3];
+    float       center[3];
+    float       light[3];
+};
+
+// the zipped models are used when they are unzipped into the obj directory
+static const AmBenchScene SCENES[] = {
+    {"fot01", "light_collection/fot01.obj", {0, 0, 2}, {0, 0, 0}, {1, 0, 2}},
+    {"fot05", "light_collection/fot05.obj", {0, 0, 2}, {0, 0, 0}, {1, 0, 2}},
+    {"fot06", "light_collection/fot06.obj", {0, 0, 2}, {0, 0, 0}, {1, 0, 2}},
+    {"fot07", "light_collection/fot07.obj", {0, 0, 2}, {0, 0, 0}, {1, 0, 2}},
+    {"fot08", "light_collection/fot08.obj", {0, 0, 2}, {0, 0, 0}, {1, 0, 2}},
+    {"table12", "table12/table12.obj", {0, 1, 2}, {0, 0, 0}, {1, 1, 2}},
+    {"mirror8", "mirror8/mirror8.obj", {1, 0.5, 2}, {0, 0, 0}, {1, 0, 2}},
+    {"mirror9", "mirror9.obj", {0, 0, 2}, {0, 0, 0}, {1, 0, 2}},
+};
+static const int SCENE_COUNT = sizeof(SCENES) / sizeof(SCENES[0]);
+
+// the metrics of a scene, in the order they are written
+enum AmMetric
+{
+    AM_LOAD,
+    AM_UTILIZE,
+    AM_BUILD,
+    AM_RENDER,
+    AM_RAYS_PER_SEC,
+    AM_PEAK_MB,
+    AM_METRICS
+};
+static const char *METRIC_NAMES[AM_METRICS] = {
+    "load", "utilize", "build", "render", "rays_per_sec", "peak_mb"
+};
+
+// times shorter than this are noise and never a regression
+static const double MIN_TIME = 0.002;
+// nor is a memory growth smaller than this, the allocator rounds it
+static const double MIN_MB = 1;
+
+static void usage(const char *name)
+{
+    cerr<<"usage: "<<name<<" [options]"<<endl
+        <<"  -obj dir         directory of the models (default obj)"<<endl
+        <<"  -o file          results, JSON (default bench.json)"<<endl
+        <<"  -baseline file   results of an earlier run to compare with"<<endl
+        <<"  -threshold t     relative slowdown or memory growth that is"<<endl
+        <<"                   a regression (default 0.1)"<<endl
+        <<"  -runs n          runs of every scene, the median is kept"<<endl
+        <<"                   (default 5)"<<endl
+        <<"  -threads n       render and parse threads, 0 for all cores"<<endl
+        <<"                   (default 0)"<<endl
+        <<"  -size WxH        resolution (default 800x600)"<<endl;
+}
+
+static double median(vector<double> values)
+{
+    sort(values.begin(), values.end());
+    size_t n = values.size();
+    return (n % 2) ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+// peak resident memory of the process in MB
+static double peakMemory()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1048576.0;    // bytes
+#else
+    return usage.ru_maxrss / 1024.0;       // KB
+#endif
+}
+
+// load, utilize, build and render the scene runs times, put the medians
+//  into metrics, all but the memory; false if the model can't be loaded
+static bool runScene(const AmBenchScene &scene, const string &dir,
+                     int runs, int threads, int width, int height,
+                     double *metrics, unsigned long long &triangles)
+{
+    string path = dir + "/" + scene.path;
+    if (!ifstream(path.c_str())) {
+        return false;
+    }
+
+    vector<double> times[AM_RAYS_PER_SEC];
+    unsigned long long rays = 0;
+    for (int run = 0; run < runs; run++) {
+        AmCameraPtr camera(new AmCamera(width, height,
+                AmVec3f(scene.eye[0], scene.eye[1], scene.eye[2]),
+                AmVec3f(scene.center[0], scene.center[1], scene.center[2]),
+                AmVec3f(0, 1, 0)));
+        float light_position[] = {scene.light[0], scene.light[1],
+                                  scene.light[2], 0.0};
+        float light_ambient[] = {1.0, 1.0, 1.0, 1.0};
+        vector<AmLightPtr> lights;
+        lights.push_back(AmLightPtr(new AmLight(AmLight::AM_POSITION,
+                                    AmLight::AM_LIGHT0, light_position)));
+        lights.push_back(AmLightPtr(new AmLight(AmLight::AM_AMBIENT,
+                                    AmLight::AM_LIGHT1, light_ambient)));
+        AmRayTracer rayTracer;
+        rayTracer.setCamera(camera);
+        rayTracer.setLight(lights);
+        rayTracer.setThreads(threads);
+
+        AmTimer timer;
+        AmLoadOptions options(threads > 0 ? threads :
+                              AmThreadPool::hardwareThreads());
+        options.normals = options.texcoords = false;
+        AmModelPtr model(new AmModel(path, options));
+        if (model->mTriangles.size() == 0) {
+            return false;
+        }
+        times[AM_LOAD].push_back(timer.elapsed());
+
+        timer.reset();
+        model->utilize();
+        times[AM_UTILIZE].push_back(timer.elapsed());
+
+        timer.reset();
+        rayTracer.setModel(model);
+        times[AM_BUILD].push_back(timer.elapsed());
+
+        AmUintPtr pixels(new unsigned int[width * height],
+                         default_delete<unsigned int[]>());
+        rayTracer.resetStats();
+        timer.reset();
+        rayTracer.render(pixels);
+        times[AM_RENDER].push_back(timer.elapsed());
+
+        rays = rayTracer.getStats().counters.rays();
+        triangles = model->mTriangles.size();
+    }
+
+    for (int i = 0; i < AM_RAYS_PER_SEC; i++) {
+        metrics[i] = median(times[i]);
+    }
+    metrics[AM_RAYS_PER_SEC] = metrics[AM_RENDER] > 0 ?
+                                rays / metrics[AM_RENDER] : 0;
+    return true;
+}
+
+// runScene in a child process. The peak memory of a process never goes
+//  down, so a scene run after a bigger one would report the bigger peak;
+//  the child starts from the small resident set of this process and
+//  reports how much its peak grew
+static bool runSceneChild(const AmBenchScene &scene, const string &dir,
+                          int runs, int threads, int width, int height,
+                          double *metrics, unsigned long long &triangles)
+{
+    // the metrics, then the triangles
+    double result[AM_METRICS + 1];
+    int fds[2];
+    if (pipe(fds) != 0) {
+        cerr<<"can't create a pipe"<<endl;
+        return false;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        cerr<<"can't fork"<<endl;
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        double start = peakMemory();
+        bool ok = runScene(scene, dir, runs, threads, width, height, result,
+                           triangles);
+        result[AM_PEAK_MB] = peakMemory() - start;
+        result[AM_METRICS] = static_cast<double>(triangles);
+        if (ok && write(fds[1], result, sizeof(result)) != sizeof(result)) {
+            ok = false;
+        }
+        _exit(ok ? 0 : 1);
+    }
+
+    close(fds[1]);
+    size_t got = 0;
+    char *bytes = reinterpret_cast<char *>(result);
+    while (got < sizeof(result)) {
+        ssize_t n = read(fds[0], bytes + got, sizeof(result) - got);
+        if (n <= 0) {
+            break;
+        }
+        got += n;
+    }
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (got != sizeof(result) || !WIFEXITED(status)
+        || WEXITSTATUS(status) != 0) {
+        return false;
+    }
+    for (int i = 0; i < AM_METRICS; i++) {
+        metrics[i] = result[i];
+    }
+    triangles = static_cast<unsigned long long>(result[AM_METRICS]);
+    return true;
+}
+
+// the number after "key": in the line
+static bool jsonNumber(const string &line, const string &key, double &value)
+{
+    string::size_type pos = line.find("\"" + key + "\":");
+    if (pos == string::npos) {
+        return false;
+    }
+    value = atof(line.c_str() + pos + key.size() + 3);
+    return true;
+}
+
+// the string after "key": in the line
+static bool jsonString(const string &line, const string &key, string &value)
+{
+    string::size_type pos = line.find("\"" + key + "\": \"");
+    if (pos == string::npos) {
+        return false;
+    }
+    pos += key.size() + 5;
+    string::size_type end = line.find('"', pos);
+    if (end == string::npos) {
+        return false;
+    }
+    value = line.substr(pos, end - pos);
+    return true;
+}
+
+// the metrics of the scenes in a results file, one scene per line as
+//  written by main
+static bool readResults(const string &path, vector<string> &names,
+                        vector<vector<double> > &metrics)
+{
+    ifstream in(path.c_str());
+    if (!in) {
+        return false;
+    }
+    string line;
+    while (getline(in, line)) {
+        string name;
+        if (!jsonString(line, "name", name)) {
+            continue;
+        }
+        vector<double> values(AM_METRICS, -1);
+        for (int i = 0; i < AM_METRICS; i++) {
+            jsonNumber(line, METRIC_NAMES[i], values[i]);
+        }
+        names.push_back(name);
+        metrics.push_back(values);
+    }
+    return true;
+}
+
+// print the regressions of a scene against its baseline, return their
+//  number. The peak memory is measured in a child of its own, so it is
+//  compared like the times
+static int compare(const string &name, const double *metrics,
+                   const vector<double> &base, double threshold)
+{
+    int regressions = 0;
+    for (int i = 0; i < AM_METRICS; i++) {
+        double now = metrics[i], old = base[i];
+        if (old <= 0) {
+            continue;
+        }
+        bool worse;
+        if (i == AM_RAYS_PER_SEC) {
+            worse = now * (1 + threshold) < old;
+        } else if (i == AM_PEAK_MB) {
+            worse = now > old * (1 + threshold) && now - old > MIN_MB;
+        } else {
+            worse = now > old * (1 + threshold) && now - old > MIN_TIME;
+        }
+        if (worse) {
+            printf("REGRESSION %-8s %-12s %10.4g -> %10.4g (%+.1f%%)\n",
+                   name.c_str(), METRIC_NAMES[i], old, now,
+                   (now / old - 1) * 100);
+            regressions++;
+        }
+    }
+    return regressions;
+}
+
+int main(int argc, char * argv[])
+{
+    string dir("obj"), output("bench.json"), baseline;
+    double threshold = 0.1;
+    int runs = 5, threads = 0, width = 800, height = 600;
+
+    for (int i = 1; i < argc; i++) {
+        string arg(argv[i]);
+        bool more = (i + 1 < argc);
+        bool ok = true;
+
+        if (arg == "-obj" && more) {
+            dir = argv[++i];
+        } else if (arg == "-o" && more) {
+            output = argv[++i];
+        } else if (arg == "-baseline" && more) {
+            baseline = argv[++i];
+        } else if (arg == "-threshold" && more) {
+            threshold = atof(argv[++i]);
+            ok = (threshold >= 0);
+        } else if (arg == "-runs" && more) {
+            runs = atoi(argv[++i]);
+            ok = (runs > 0);
+        } else if (arg == "-threads" && more) {
+            threads = atoi(argv[++i]);
+        } else if (arg == "-size" && more) {
+            ok = (sscanf(argv[++i], "%dx%d", &width, &height) == 2
+                  && width > 0 && height > 0);
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            cerr<<"bad argument: "<<arg<<endl;
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    vector<string> baseNames;
+    vector<vector<double> > baseMetrics;
+    if (!baseline.empty() && !readResults(baseline, baseNames, baseMetrics)) {
+        cerr<<"can't read baseline: "<<baseline<<endl;
+        return 1;
+    }
+
+    ofstream out(output.c_str());
+    if (!out) {
+        cerr<<"can't write results: "<<output<<endl;
+        return 1;
+    }
+    out.precision(6);
+    out<<"{"<<endl;
+    out<<"  \"threads\": "<<(threads > 0 ? threads :
+                              AmThreadPool::hardwareThreads())
+        <<", \"width\": "<<width<<", \"height\": "<<height
+        <<", \"runs\": "<<runs<<","<<endl;
+    out<<"  \"scenes\": ["<<endl;
+
+    printf("%-8s %9s %8s %8s %8s %8s %10s %8s\n", "scene", "triangles",
+           "load", "utilize", "build", "render", "Mrays/s", "peak MB");
+    int regressions = 0, done = 0;
+    for (int s = 0; s < SCENE_COUNT; s++) {
+        const AmBenchScene &scene = SCENES[s];
+        double metrics[AM_METRICS];
+        unsigned long long triangles = 0;
+        if (!runSceneChild(scene, dir, runs, threads, width, height, metrics,
+                           triangles)) {
+            printf("%-8s skipped, no model at %s/%s\n", scene.name,
+                   dir.c_str(), scene.path);
+            continue;
+        }
+        printf("%-8s %9llu %8.4f %8.4f %8.4f %8.4f %10.3f %8.1f\n",
+               scene.name, triangles, metrics[AM_LOAD], metrics[AM_UTILIZE],
+               metrics[AM_BUILD], metrics[AM_RENDER],
+               metrics[AM_RAYS_PER_SEC] / 1e6, metrics[AM_PEAK_MB]);
+
+        out<<(done ? ",\n" : "")<<"    {\"name\": \""<<scene.name
+            <<"\", \"triangles\": "<<triangles;
+        for (int i = 0; i < AM_METRICS; i++) {
+            out<<", \""<<METRIC_NAMES[i]<<"\": "<<metrics[i];
+        }
+        out<<"}";
+        done++;
+
+        for (size_t b = 0; b < baseNames.size(); b++) {
+            if (baseNames[b] == scene.name) {
+                regressions += compare(scene.name, metrics, baseMetrics[b],
+                                       threshold);
+            }
+        }
+    }
+    out<<endl<<"  ]"<<endl<<"}"<<endl;
+
+    if (done == 0) {
+        cerr<<"no models found in "<<dir<<endl;
+        return 1;
+    }
+    if (!baseline.empty()) {
+        printf("%d regressions above %.0f%% against %s\n", regressions,
+               threshold * 100, baseline.c_str());
+    }
+    return regressions > 0 ? 2 : 0;
+}
@@ -0,0 +1,299 @@
+//
+//  bvh.cpp
+//  raytracer
+//
+//  Created by ambling on 13-5-20.
+//  Copyright (c) 2013年 ambling. All rights reserved.
+//
+
+#include "bvh.h"
+#include "model.h"
+#include "raytracer.h"
+
+using namespace std;
+using namespace raytracer;
+
+
+const float AmBVH::SAH_TRAVERSAL = 1.0;
+const float AmBVH::SAH_INTERSECT = 1.5;
+
+// half surface area of a box, the factor 2 cancels out in the ratios
+static float halfArea(const AmVec3f &start, const AmVec3f &end)
+{
+    AmVec3f size = end - start;
+    return size.x()*size.y() + size.y()*size.z() + size.z()*size.x();
+}
+
+static void grow(AmVec3f &start, AmVec3f &end,
+                 const AmVec3f &pstart, const AmVec3f &pend)
+{
+    for (int a = 0; a < 3; a++) {
+        start.mData[a] = min(start.mData[a], pstart.mData[a]);
+        end.mData[a] = max(end.mData[a], pend.mData[a]);
+    }
+}
+
+// build the whole hierarchy from the bounding boxes of the triangles
+void AmBVH::init()
+{
+    bvhNodes.clear();
+    triangles.clear();
+    
+    vector<AmBVHPrim> prims(model->mTriangles.size());
+    for (unsigned int i = 0; i < model->mTriangles.size(); i++) {
+        prims[i].start = model->mTriangles[i].start;
+        prims[i].end = model->mTriangles[i].end;
+        prims[i].center = (prims[i].start + prims[i].end) * 0.5;
+        prims[i].index = i;
+    }
+    if (prims.empty()) {
+        return;
+    }
+    
+    bvhNodes.reserve(prims.size() * 2);
+    triangles.reserve(prims.size());
+    buildRange(prims, 0, static_cast<int>(prims.size()), 0);
+}
+
+// build the node of prims[first, last), return its index
+unsigned int AmBVH::buildRange(vector<AmBVHPrim> &prims,
+                               int first, int last, int depth)
+{
+    unsigned int index = static_cast<unsigned int>(bvhNodes.size());
+    bvhNodes.push_back(AmBVHNode());
+    
+    AmVec3f start(M_MAX, M_MAX, M_MAX), end(M_MIN, M_MIN, M_MIN);
+    AmVec3f cstart(M_MAX, M_MAX, M_MAX), cend(M_MIN, M_MIN, M_MIN);
+    for (int i = first; i < last; i++) {
+        grow(start, end, prims[i].start, prims[i].end);
+        grow(cstart, cend, prims[i].center, prims[i].center);
+    }
+    for (int a = 0; a < 3; a++) {
+        bvhNodes[index].bmin[a] = start.mData[a];
+        bvhNodes[index].bmax[a] = end.mData[a];
+    }
+    
+    int n = last - first;
+    float area = halfArea(start, end);
+    
+    // find the cheapest split between the bins of the centers
+    int bestAxis = -1, bestSplit = 0;
+    float bestCost = SAH_INTERSECT * n;  // cost of a leaf
+    bool forced = (n > MAX_LEAF);        // too many meshes for a leaf
+    for (int axis = 0; axis < 3 && n > 1; axis++) {
+        float lo = cstart.mData[axis];
+        float extent = cend.mData[axis] - lo;
+        if (extent <= 0) {
+            continue;
+        }
+        
+        int counts[BINS] = {0};
+        AmVec3f bstart[BINS], bend[BINS];
+        for (int b = 0; b < BINS; b++) {
+            bstart[b] = AmVec3f(M_MAX, M_MAX, M_MAX);
+            bend[b] = AmVec3f(M_MIN, M_MIN, M_MIN);
+        }
+        for (int i = first; i < last; i++) {
+            int b = static_cast<int>(BINS * (prims[i].center.mData[axis] - lo)
+                                     / extent);
+            b = min(b, BINS - 1);
+            counts[b]++;
+            grow(bstart[b], bend[b], prims[i].start, prims[i].end);
+        }
+        
+        // areas and counts right of every split, swept from the right
+        float rightArea[BINS];
+        int rightCount[BINS];
+        AmVec3f rs(M_MAX, M_MAX, M_MAX), re(M_MIN, M_MIN, M_MIN);
+        int rc = 0;
+        for (int b = BINS - 1; b > 0; b--) {
+            grow(rs, re, bstart[b], bend[b]);
+            rc += counts[b];
+            rightArea[b] = rc ? halfArea(rs, re) : 0;
+            rightCount[b] = rc;
+        }
+        
+        AmVec3f ls(M_MAX, M_MAX, M_MAX), le(M_MIN, M_MIN, M_MIN);
+        int lc = 0;
+        for (int b = 1; b < BINS; b++) {
+            grow(ls, le, bstart[b-1], bend[b-1]);
+            lc += counts[b-1];
+            if (lc == 0 || rightCount[b] == 0) {
+                continue;
+            }
+            float cost = SAH_TRAVERSAL + SAH_INTERSECT
+                        * (halfArea(ls, le) * lc + rightArea[b] * rightCount[b])
+                        / area;
+            if (cost < bestCost || (forced && bestAxis < 0)) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = b;
+            }
+        }
+    }
+    
+    int mid = -1;
+    if (bestAxis >= 0 && depth < MAX_DEPTH - 1) {
+        float lo = cstart.mData[bestAxis];
+        float extent = cend.mData[bestAxis] - lo;
+        AmBVHPrim *middle = partition(&prims[0] + first, &prims[0] + last,
+                                      [=](const AmBVHPrim &p) {
+            int b = static_cast<int>(BINS * (p.center.mData[bestAxis] - lo)
+                                     / extent);
+            return min(b, BINS - 1) < bestSplit;
+        });
+        mid = static_cast<int>(middle - &prims[0]);
+    } else if (forced && depth < MAX_DEPTH - 1) {
+        // all the centers are at the same point, split by count
+        mid = first + n / 2;
+        bestAxis = 0;
+    }
+    
+    if (mid <= first || mid >= last) {
+        // leaf
+        bvhNodes[index].offset = static_cast<unsigned int>(triangles.size());
+        bvhNodes[index].count = static_cast<unsigned short>(n);
+        bvhNodes[index].axis = 0;
+        assert(n < 65536);
+        for (int i = first; i < last; i++) {
+            triangles.append(*model, prims[i].index);
+        }
+        return index;
+    }
+    
+    bvhNodes[index].count = 0;
+    bvhNodes[index].axis = static_cast<unsigned short>(bestAxis);
+    buildRange(prims, first, mid, depth + 1);   // the next node
+    unsigned int second = buildRange(prims, mid, last, depth + 1);
+    bvhNodes[index].offset = second;
+    return index;
+}
+
+void AmBVH::report(ostream &os) const
+{
+    size_t leaves = 0;
+    for (size_t i = 0; i < bvhNodes.size(); i++) {
+        if (bvhNodes[i].count > 0) {
+            leaves++;
+        }
+    }
+    size_t bytes = bvhNodes.size() * sizeof(AmBVHNode)
+                    + triangles.bytes();
+    os<<"bvh nodes: "<<bvhNodes.size()<<" ("<<leaves<<" leaves, "
+      <<sizeof(AmBVHNode)<<" bytes per node)"<<endl;
+    os<<"bvh memory: "<<bytes<<" bytes"<<endl;
+}
+
+
+///// bvh traversal ///////
+
+// slab test, true if the ray enters the box before tmax,
+//  the sign of the direction picks the near and far planes
+bool AmBVH::hitBox(const AmBVHNode &node, const AmRay &ray, float tmax) const
+{
+    const float *bounds[2] = {node.bmin, node.bmax};
+    float t0 = 0, t1 = tmax;
+    for (int a = 0; a < 3; a++) {
+        float tnear = (bounds[ray.sign[a]][a] - ray.orig.mData[a])
+                        * ray.invDir.mData[a];
+        float tfar = (bounds[1 - ray.sign[a]][a] - ray.orig.mData[a])
+                        * ray.invDir.mData[a];
+        // written so that a NaN (ray on the slab border) keeps the old value
+        t0 = tnear > t0 ? tnear : t0;
+        t1 = tfar < t1 ? tfar : t1;
+    }
+    return t0 <= t1 + EPSILON;
+}
+
+// closest hit, the nearer child is visited first
+float AmBVH::search(const AmRay &ray, int &index) const
+{
+    float hit = -1;
+    index = -1;
+    if (bvhNodes.empty()) {
+        return hit;
+    }
+    
+    float tmax = M_MAX;
+    unsigned int stack[MAX_DEPTH];
+    int top = 0;
+    unsigned int node = 0;
+    AmTraversalCounts counts;
+    while (1) {
+        const AmBVHNode &thenode = bvhNodes[node];
+        if (hitBox(thenode, ray, tmax)) {
+            if (thenode.count > 0) {
+                counts.leaves++;
+                counts.tests += thenode.count;
+                unsigned int end = thenode.offset + thenode.count;
+                for (unsigned int i = thenode.offset; i < end; i++) {
+                    int j = triangles.meshes[i];
+                    float t = triangles.hit(i, ray);
+                    if (t > EPSILON && (hit < 0 || t < hit ||
+                                        (t == hit && j < index))) {
+                        hit = t;
+                        index = j;
+                        tmax = t;
+                    }
+                }
+            } else {
+                counts.nodes++;
+                if (ray.sign[thenode.axis]) {
+                    stack[top++] = node + 1;
+                    node = thenode.offset;
+                } else {
+                    stack[top++] = thenode.offset;
+                    node = node + 1;
+                }
+                continue;
+            }
+        }
+        if (top == 0) {
+            break;
+        }
+        node = stack[--top];
+    }
+    return hit;
+}
+
+// any hit, stop at the first blocking mesh
+bool AmBVH::occluded(const AmRay &ray, float tmax, int ignore) const
+{
+    if (bvhNodes.empty()) {
+        return false;
+    }
+    
+    unsigned int stack[MAX_DEPTH];
+    int top = 0;
+    unsigned int node = 0;
+    AmTraversalCounts counts;
+    while (1) {
+        const AmBVHNode &thenode = bvhNodes[node];
+        if (hitBox(thenode, ray, tmax)) {
+            if (thenode.count > 0) {
+                counts.leaves++;
+                counts.tests += thenode.count;
+                unsigned int end = thenode.offset + thenode.count;
+                for (unsigned int i = thenode.offset; i < end; i++) {
+                    if (triangles.meshes[i] == ignore) {
+                        continue;
+                    }
+                    float t = triangles.hit(i, ray);
+                    if (t > EPSILON && t < tmax) {
+                        return true;
+                    }
+                }
+            } else {
+                counts.nodes++;
+                stack[top++] = thenode.offset;
+                node = node + 1;
+                continue;
+            }
+        }
+        if (top == 0) {
+            break;
+        }
+        node = stack[--top];
+    }
+    return false;
+}
@@ -0,0 +1,79 @@
+//
+//  bvh.h
+//  raytracer
+//
+//  bounding volume hierarchy built with the binned surface area heuristic
+//
+//  Created by ambling on 13-5-20.
+//  Copyright (c) 2013年 ambling. All rights reserved.
+//
+
+#ifndef raytracer_bvh_h
+#define raytracer_bvh_h
+
+#include "utils.h"
+#include "accel.h"
+
+using namespace std;
+
+namespace raytracer {
+    
+    
+    /*
+     * BVH node, 32 bytes, nodes are stored in depth-first order so the
+     *  first child of an interior node is the next node
+     */
+    class AmBVHNode
+    {
+    public:
+        float           bmin[3];    // bounding box
+        float           bmax[3];
+        unsigned int    offset;     // leaf: first mesh in the triangle buffer,
+                                    // interior: index of the second child
+        unsigned short  count;      // number of meshes, 0 for interior nodes
+        unsigned short  axis;       // split axis of interior nodes
+    };
+    
+    
+    /*
+     * BVH to accelerate the tracing
+     */
+    class AmBVH : public AmAccelerator
+    {
+    public:
+        static const int BINS = 12;         // SAH bins per axis
+        static const int MAX_LEAF = 4;      // meshes that may stay in a leaf
+        static const int MAX_DEPTH = 64;    // size of the traversal stack
+        
+        // cost of one traversal step and one ray-mesh test
+        static const float SAH_TRAVERSAL;
+        static const float SAH_INTERSECT;
+        
+        vector<AmBVHNode>   bvhNodes;
+        AmTriangleBuffer    triangles;  // meshes of all the leaves
+        
+        void    init();
+        float   search(const AmRay &ray, int &index) const;
+        bool    occluded(const AmRay &ray, float tmax, int ignore) const;
+        void    report(ostream &os) const;
+        
+    private:
+        // a mesh during the build
+        class AmBVHPrim
+        {
+        public:
+            AmVec3f start, end; // bounding box
+            AmVec3f center;     // center of the bounding box
+            int     index;
+        };
+        
+        unsigned int buildRange(vector<AmBVHPrim> &prims,
+                                int first, int last, int depth);
+        bool hitBox(const AmBVHNode &node, const AmRay &ray,
+                    float tmax) const;
+    };
+    
+}
+
+
+#endif
@@ -0,0 +1,43 @@
+//
+//  convert.cpp
+//  raytracer
+//
+//  convert a wavefront obj model into a binary scene file, which the
+//  renderers load by mapping it instead of parsing the text
+//
+//  Created by ambling on 13-5-28.
+//  Copyright (c) 2013年 ambling. All rights reserved.
+//
+
+#include <iostream>
+#include "utils.h"
+#include "model.h"
+
+using namespace raytracer;
+
+int main(int argc, char * argv[])
+{
+    if (argc != 3) {
+        cerr<<"usage: "<<argv[0]<<" model.obj scene.amscene"<<endl;
+        return 1;
+    }
+    
+    AmTimer timer;
+    AmModel model(argv[1], AmThreadPool::hardwareThreads());
+    model.utilize();
+    double parseTime = timer.elapsed();
+    
+    timer.reset();
+    if (!model.writeScene(argv[2])) {
+        cerr<<"can't write scene: "<<argv[2]<<endl;
+        return 1;
+    }
+    double writeTime = timer.elapsed();
+    
+    cout<<"triangles: "<<model.mTriangles.size()<<endl;
+    cout<<"vertices:  "<<model.mVertices.size() - 1<<endl;
+    cout<<"groups:    "<<model.mGroups.size()<<endl;
+    cout<<"read:      "<<parseTime<<" s"<<endl;
+    cout<<"write:     "<<writeTime<<" s"<<endl;
+    return 0;
+}
@@ -11,8 +11,6 @@
 #include "model.h"
 #include "raytracer.h"
 
-#include <ctime> //timer
-
 using namespace std;
 
 namespace raytracer
@@ -26,10 +24,19 @@ namespace raytracer
     AmRayTracerPtr rayTracer;
     AmUintPtr pixels;
     
+    // progressive rendering: the stride of the pass in progress and the
+    //  next row of it, stride 0 when the frame is complete
+    int stride, strideRow;
+    bool moved;     // the camera moved since the complete frame
+    const double FRAME_BUDGET = 0.03;   // seconds of tracing per display
+    const int BAND_ROWS = 16;           // rows traced between budget checks
+    
     void idle(void);
     void display(void);
     void keyboard(unsigned char key, int x, int y);
     void reshape(int w, int h);
+    void restartRefine();
+    void cameraMoved();
     
 	MyOpengl::MyOpengl( int argc,  char** argv) :
         mWidth(800), mHeight(600)
@@ -73,8 +80,11 @@ namespace raytracer
         rayTracer = AmRayTracerPtr(new AmRayTracer());
         rayTracer->setCamera(camera);
         rayTracer->setLight(lights);
+        rayTracer->setThreads(0); // all hardware threads
+        rayTracer->setReprojection(true);
         
         pixels = AmUintPtr(new unsigned int[width * height]);
+        restartRefine();
     }
     
 	void MyOpengl::init()
@@ -106,12 +116,57 @@ namespace raytracer
             glutBitmapCharacter(font, str[i]);
     }
     
+    // start the progressive rendering over from the coarsest pass,
+    //  after the camera or the window changed
+    void restartRefine()
+    {
+        stride = AmRayTracer::COARSE_STRIDE;
+        strideRow = 0;
+        moved = false;
+    }
+    
+    // a complete frame is reprojected into the moved camera, a frame
+    //  still refining has too few pixels kept and starts over
+    void cameraMoved()
+    {
+        if (stride == 0) {
+            moved = true;
+        } else {
+            restartRefine();
+        }
+    }
+    
+    // trace bands of the current pass until the budget is used, the
+    //  coarsest pass is always finished so the whole window is covered
+    void refine()
+    {
+        AmTimer timer;
+        while (stride > 0) {
+            int y1 = min(strideRow + BAND_ROWS, height);
+            rayTracer->renderStride(pixels, stride, strideRow, y1);
+            strideRow = y1;
+            if (strideRow >= height) {
+                stride /= 2;
+                strideRow = 0;
+            }
+            if (stride < AmRayTracer::COARSE_STRIDE
+                && timer.elapsed() > FRAME_BUDGET) {
+                break;
+            }
+        }
+    }
+    
     void raytracerDraw()
     {
         glDisable(GL_DEPTH_TEST);
         glDisable(GL_COLOR_MATERIAL);
         glDisable(GL_LIGHTING);
-        rayTracer->render(pixels);
+        if (moved) {
+            rayTracer->reproject(pixels);
+            moved = false;
+        } else {
+            refine();
+        }
         
         glWindowPos2i(0, 0);
         glDrawPixels(width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.get());
@@ -174,9 +229,13 @@ namespace raytracer
     
     /////// OpenGL reliable functions /////////////
     
+    // redraw while the raytracer refines the frame, the OpenGL drawing
+    //  is redrawn all the time
     void idle(void)
     {
-        glutPostRedisplay();
+        if (stride > 0 || !myDraw) {
+            glutPostRedisplay();
+        }
     }
     
     void reshape(int w, int h)
@@ -188,7 +247,7 @@ namespace raytracer
         camera->update();
         
         pixels = AmUintPtr(new unsigned int[w*h]);
-        
+        restartRefine();
     }
     
     void display(void)
@@ -210,8 +269,8 @@ namespace raytracer
         glMatrixMode(GL_MODELVIEW);
         glLoadIdentity();
         
-        // start the timer
-        clock_t startTime = clock();
+        AmTimer timer;
+        rayTracer->resetStats();
         
         if (myDraw) {
             // use the raytracer functions of the model
@@ -221,20 +280,44 @@ namespace raytracer
             openglDraw();
         }
         
-        // stop the timer
-        clock_t endTime = clock();
-        //show the fps
-        double fps = 1.0 * CLOCKS_PER_SEC / (endTime - startTime);
+        // show the wall time of the frame and the counters of the
+        //  raytracer, the lines go up from the bottom of the window
+        vector<string> lines;
         ostringstream oss;
-        oss.precision(10);
-        oss<<"fps: "<<fps;
+        oss<<"frame: "<<timer.elapsed() * 1000<<" ms";
+        lines.push_back(oss.str());
+        if (myDraw) {
+            const AmStats &stats = rayTracer->getStats();
+            const unsigned long long *v = stats.counters.value;
+            oss.str("");
+            oss<<"trace "<<stats.times[AmStats::AM_TRACE] * 1000
+                <<" ms, reproject "<<stats.times[AmStats::AM_REPROJECT] * 1000
+                <<" ms";
+            lines.push_back(oss.str());
+            oss.str("");
+            oss<<"rays: primary "<<v[AmCounters::AM_PRIMARY_RAYS]
+                <<", shadow "<<v[AmCounters::AM_SHADOW_RAYS]
+                <<", reflection "<<v[AmCounters::AM_REFLECTION_RAYS]
+                <<", refraction "<<v[AmCounters::AM_REFRACTION_RAYS];
+            lines.push_back(oss.str());
+            oss.str("");
+            oss<<"nodes "<<v[AmCounters::AM_NODES]
+                <<", leaves "<<v[AmCounters::AM_LEAVES]
+                <<", triangle tests "<<v[AmCounters::AM_TRIANGLE_TESTS]
+                <<", hits "<<v[AmCounters::AM_HITS];
+            lines.push_back(oss.str());
+        }
         glDisable(GL_COLOR_MATERIAL);
         glColor3f(1.f, 1.f, 1.f);
-        if (width <= height)
-            glRasterPos2f(-0.9, -0.9*(GLfloat)height/(GLfloat)width);
-        else
-            glRasterPos2f(-0.9*(GLfloat)width/(GLfloat)height, -0.9);
-        PrintString(GLUT_BITMAP_HELVETICA_18, oss.str());
+        float lineHeight = 2.0 * 20 / height;   // 20 pixels
+        for (int i = 0; i < lines.size(); i++) {
+            float y = -0.95 + i * lineHeight;
+            if (width <= height)
+                glRasterPos2f(-0.95, y*(GLfloat)height/(GLfloat)width);
+            else
+                glRasterPos2f(-0.95*(GLfloat)width/(GLfloat)height, y);
+            PrintString(GLUT_BITMAP_HELVETICA_12, lines[lines.size() - 1 - i]);
+        }
         
         glutSwapBuffers();
     }
@@ -250,7 +333,6 @@ namespace raytracer
         if (key == ' ')
         {// space key to switch the render function (raytracer or OpenGL)
             myDraw = !myDraw;
-            glutPostRedisplay();
         }
         
         float step = 0.1;
@@ -260,6 +342,7 @@ namespace raytracer
             AmVec3f move = camera->dir * step;
             camera->eye = camera->eye + move;
             camera->update();
+            cameraMoved();
         }
         
         if (key == 's')
@@ -267,19 +350,23 @@ namespace raytracer
             AmVec3f move = camera->dir * step;
             camera->eye = camera->eye - move;
             camera->update();
+            cameraMoved();
         }
         
         if (key == 'a')
         {// move left
             camera->eye = camera->eye - AmVec3f(step, 0, 0);
             camera->update();
+            cameraMoved();
         }
         
         if (key == 'd')
         {// move right
             camera->eye = camera->eye + AmVec3f(step, 0, 0);
             camera->update();
+            cameraMoved();
         }
+        glutPostRedisplay();
     }
     
 }
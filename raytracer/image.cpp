@@ -0,0 +1,160 @@
+//
+//  image.cpp
+//  raytracer
+//
+//  Created by ambling on 13-5-14.
+//  Copyright (c) 2013年 ambling. All rights reserved.
+//
+
+#include "image.h"
+
+#include <fstream>
+#include <cctype>
+
+using namespace std;
+using namespace raytracer;
+
+
+// rows of RGB bytes, the first row of pixels is the bottom of the image
+//  (OpenGL convention), the first row of the file is the top
+static void toRGBRows(const unsigned int *pixels, int width, int height,
+                      vector<unsigned char> &rgb, int rowPrefix)
+{
+    int rowBytes = width * 3 + rowPrefix;
+    rgb.assign(rowBytes * height, 0);
+    for (int h = 0; h < height; h++) {
+        const unsigned int *src = pixels + (height - 1 - h) * width;
+        unsigned char *dst = &rgb[h * rowBytes + rowPrefix];
+        for (int w = 0; w < width; w++) {
+            dst[w*3]     = src[w] & 0xff;
+            dst[w*3 + 1] = (src[w] >> 8) & 0xff;
+            dst[w*3 + 2] = (src[w] >> 16) & 0xff;
+        }
+    }
+}
+
+bool AmImage::writePPM(const string &filename, const unsigned int *pixels,
+                       int width, int height)
+{
+    ofstream ofs(filename.c_str(), ios::binary);
+    if (!ofs) {
+        return false;
+    }
+    
+    vector<unsigned char> rgb;
+    toRGBRows(pixels, width, height, rgb, 0);
+    ofs<<"P6\n"<<width<<" "<<height<<"\n255\n";
+    ofs.write(reinterpret_cast<const char *>(&rgb[0]), rgb.size());
+    return static_cast<bool>(ofs);
+}
+
+
+//////// PNG helpers ////////
+
+static unsigned int crc32(const unsigned char *data, size_t len,
+                          unsigned int crc = 0)
+{
+    static unsigned int table[256];
+    static bool init = false;
+    if (!init) {
+        for (unsigned int n = 0; n < 256; n++) {
+            unsigned int c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+        init = true;
+    }
+    
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void putBE32(vector<unsigned char> &out, unsigned int v)
+{
+    out.push_back((v >> 24) & 0xff);
+    out.push_back((v >> 16) & 0xff);
+    out.push_back((v >> 8) & 0xff);
+    out.push_back(v & 0xff);
+}
+
+static void writeChunk(ofstream &ofs, const char *type,
+                       const vector<unsigned char> &data)
+{
+    vector<unsigned char> chunk;
+    putBE32(chunk, static_cast<unsigned int>(data.size()));
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    // the crc covers the type and the data
+    putBE32(chunk, crc32(&chunk[4], chunk.size() - 4));
+    ofs.write(reinterpret_cast<const char *>(&chunk[0]), chunk.size());
+}
+
+bool AmImage::writePNG(const string &filename, const unsigned int *pixels,
+                       int width, int height)
+{
+    ofstream ofs(filename.c_str(), ios::binary);
+    if (!ofs) {
+        return false;
+    }
+    
+    // every row starts with filter type 0
+    vector<unsigned char> raw;
+    toRGBRows(pixels, width, height, raw, 1);
+    
+    // zlib stream of stored deflate blocks
+    vector<unsigned char> zdata;
+    zdata.push_back(0x78);
+    zdata.push_back(0x01);
+    size_t pos = 0;
+    do {
+        size_t len = min(raw.size() - pos, size_t(65535));
+        bool last = (pos + len == raw.size());
+        zdata.push_back(last ? 1 : 0);
+        zdata.push_back(len & 0xff);
+        zdata.push_back((len >> 8) & 0xff);
+        zdata.push_back(~len & 0xff);
+        zdata.push_back((~len >> 8) & 0xff);
+        zdata.insert(zdata.end(), raw.begin() + pos, raw.begin() + pos + len);
+        pos += len;
+    } while (pos < raw.size());
+    
+    unsigned int a = 1, b = 0; // adler32
+    for (size_t i = 0; i < raw.size(); i++) {
+        a = (a + raw[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    putBE32(zdata, (b << 16) | a);
+    
+    const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    ofs.write(reinterpret_cast<const char *>(signature), 8);
+    
+    vector<unsigned char> header;
+    putBE32(header, width);
+    putBE32(header, height);
+    header.push_back(8);    // bit depth
+    header.push_back(2);    // color type: RGB
+    header.push_back(0);    // compression
+    header.push_back(0);    // filter
+    header.push_back(0);    // no interlace
+    writeChunk(ofs, "IHDR", header);
+    writeChunk(ofs, "IDAT", zdata);
+    writeChunk(ofs, "IEND", vector<unsigned char>());
+    return static_cast<bool>(ofs);
+}
+
+bool AmImage::write(const string &filename, const unsigned int *pixels,
+                    int width, int height)
+{
+    string::size_type dot = filename.rfind('.');
+    string ext = (dot == string::npos) ? "" : filename.substr(dot + 1);
+    transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    if (ext == "png") {
+        return writePNG(filename, pixels, width, height);
+    }
+    return writePPM(filename, pixels, width, height);
+}
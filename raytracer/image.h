@@ -0,0 +1,40 @@
+//
+//  image.h
+//  raytracer
+//
+//  write the rendered pixel buffer to image files,
+//  pixels are packed as in glDrawPixels(GL_RGBA, GL_UNSIGNED_BYTE):
+//  red in the lowest byte, then green and blue
+//
+//  Created by ambling on 13-5-14.
+//  Copyright (c) 2013年 ambling. All rights reserved.
+//
+
+#ifndef raytracer_image_h
+#define raytracer_image_h
+
+#include "utils.h"
+
+using namespace std;
+
+namespace raytracer {
+    
+    class AmImage
+    {
+    public:
+        // binary PPM (P6), return false if the file can't be written
+        static bool writePPM(const string &filename, const unsigned int *pixels,
+                             int width, int height);
+        
+        // 8 bit RGB PNG, stored without compression
+        static bool writePNG(const string &filename, const unsigned int *pixels,
+                             int width, int height);
+        
+        // choose the format from the extension of the filename
+        static bool write(const string &filename, const unsigned int *pixels,
+                          int width, int height);
+    };
+    
+}
+
+#endif
@@ -0,0 +1,1169 @@
+//
+//  kdtree.cpp
+//  raytracer
+//
+//  Created by ambling on 13-5-20.
+//  Copyright (c) 2013年 ambling. All rights reserved.
+//
+
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <unistd.h>
+#include "kdtree.h"
+#include "model.h"
+#include "raytracer.h"
+#include "simd.h"
+#include "mapfile.h"
+
+using namespace std;
+using namespace raytracer;
+
+
+const float AmKDTree::SAH_TRAVERSAL = 1.0;
+const float AmKDTree::SAH_INTERSECT = 1.5;
+const float AmKDTree::SAH_EMPTY_BONUS = 0.2;
+
+void AmKDTreeNode::addMeshBound(const AmTriangle &m)
+{
+    for (int axis = 0; axis < 3; axis++) {
+        meshStart.mData[axis] = min(meshStart.mData[axis], m.start.mData[axis]);
+        meshEnd.mData[axis] = max(meshEnd.mData[axis], m.end.mData[axis]);
+    }
+}
+
+// init the root node of kd-tree and call to build the whole tree
+void AmKDTree::init()
+{
+    //clear exist data
+    nodes.clear();
+    cached = false;
+    AmTimer timer;
+    
+    AmKDTreeNodePtr root(new AmKDTreeNode);
+    for (unsigned int i = 0; i < model->mTriangles.size(); i++) {
+        // triangles start from index 0
+        root->meshes.push_back(i);
+    }
+    
+    AmVec3f vmax(M_MIN, M_MIN, M_MIN);
+    AmVec3f vmin(M_MAX, M_MAX, M_MAX);
+    for (unsigned int i = 1; i < model->mVertices.size(); i++) {
+        if (model->mVertices[i].x() > vmax.x()) {
+            vmax.setX(model->mVertices[i].x());
+        }
+        if (model->mVertices[i].y() > vmax.y()) {
+            vmax.setY(model->mVertices[i].y());
+        }
+        if (model->mVertices[i].z() > vmax.z()) {
+            vmax.setZ(model->mVertices[i].z());
+        }
+        if (model->mVertices[i].x() < vmin.x()) {
+            vmin.setX(model->mVertices[i].x());
+        }
+        if (model->mVertices[i].y() < vmin.y()) {
+            vmin.setY(model->mVertices[i].y());
+        }
+        if (model->mVertices[i].z() < vmin.z()) {
+            vmin.setZ(model->mVertices[i].z());
+        }
+    }
+    root->start = vmin;
+    root->end = vmax;
+    
+    if (heuristic == AM_SAH) {
+        // a bound that grows with the scene, the cost function is the
+        //  real termination rule
+        maxDepth = static_cast<int>(8 + 1.3 * log2(max(root->meshes.size(),
+                                                      size_t(1))));
+        maxDepth = min(maxDepth, static_cast<int>(MAX_DEPTH));
+    } else {
+        maxDepth = 16;
+    }
+    
+    for (unsigned int i = 0; i < model->mTriangles.size(); i++) {
+        root->addMeshBound(model->mTriangles[i]);
+    }
+    if (heuristic == AM_SAH) {
+        initEvents(root);
+    }
+    nodes.push_back(root);
+    if (pool && pool->size() > 1) {
+        buildParallel();
+    } else {
+        buildNode(nodes, 0);
+    }
+    flatten();
+    buildTime = timer.elapsed();
+}
+
+// sort the bounds of all the meshes once, on the three axes;
+//  the splits keep them in order, so the SAH sweep of a node is linear
+void AmKDTree::initEvents(const AmKDTreeNodePtr &root)
+{
+    vector<AmKDTreeEvent> *lists[6];
+    for (int axis = 0; axis < 3; axis++) {
+        lists[2 * axis] = &root->startEvents[axis];
+        lists[2 * axis + 1] = &root->endEvents[axis];
+    }
+    
+    vector<AmThreadPool::AmTask> tasks;
+    for (int k = 0; k < 6; k++) {
+        vector<AmKDTreeEvent> *list = lists[k];
+        int axis = k / 2;
+        bool start = (k % 2 == 0);
+        tasks.push_back([this, root, list, axis, start](int) {
+            list->resize(root->meshes.size());
+            for (size_t i = 0; i < root->meshes.size(); i++) {
+                const AmTriangle &m = model->mTriangles[root->meshes[i]];
+                (*list)[i].pos = start ? m.start.mData[axis]
+                                       : m.end.mData[axis];
+                (*list)[i].mesh = root->meshes[i];
+            }
+            sort(list->begin(), list->end());
+        });
+    }
+    if (pool && pool->size() > 1) {
+        pool->run(tasks);
+    } else {
+        for (int k = 0; k < 6; k++) {
+            tasks[k](0);
+        }
+    }
+}
+
+// copy the tree into the compact depth-first layout, then free the
+//  build nodes
+void AmKDTree::flatten()
+{
+    flatNodes.clear();
+    triangles.clear();
+    cacheFile.close();
+    flatNodes.reserve(nodes.size());
+    boxStart = nodes[0]->start;
+    boxEnd = nodes[0]->end;
+    
+    // build node to copy, and the flat node waiting for it as right child
+    vector<pair<int, int> > todo;
+    todo.push_back(make_pair(0, -1));
+    while (!todo.empty()) {
+        int index = todo.back().first;
+        int parent = todo.back().second;
+        todo.pop_back();
+        
+        unsigned int flat = static_cast<unsigned int>(flatNodes.size());
+        if (parent >= 0) {
+            flatNodes[parent].initInterior(flatNodes[parent].axis(),
+                                           flatNodes[parent].split, flat);
+        }
+        
+        AmKDTreeNodePtr thenode = nodes[index];
+        AmKDTreeFlatNode node;
+        if (thenode->leaf) {
+            // every leaf starts on a vector and is padded to fill its last
+            //  one, searchLeaf then needs no scalar loop for the rest
+            unsigned int first = static_cast<unsigned int>(triangles.size());
+            for (size_t i = 0; i < thenode->meshes.size(); i++) {
+                triangles.append(*model, thenode->meshes[i]);
+            }
+            triangles.pad(AM_SIMD_WIDTH);
+            node.initLeaf(first, static_cast<unsigned int>(triangles.size())
+                                 - first);
+        } else {
+            node.initInterior(thenode->plane.axis, thenode->plane.value, 0);
+            // the left child is copied first, right after its parent
+            todo.push_back(make_pair(thenode->rightChild, flat));
+            todo.push_back(make_pair(thenode->leftChild, -1));
+        }
+        flatNodes.push_back(node);
+    }
+    
+    vector<AmKDTreeNodePtr>().swap(nodes);
+}
+
+void AmKDTree::report(ostream &os) const
+{
+    size_t leaves = 0, meshes = 0;
+    for (size_t i = 0; i < flatNodes.size(); i++) {
+        if (flatNodes[i].leaf()) {
+            leaves++;
+        }
+    }
+    for (size_t i = 0; i < triangles.size(); i++) {
+        if (triangles.meshes[i] >= 0) {
+            meshes++;
+        }
+    }
+    size_t bytes = flatNodes.size() * sizeof(AmKDTreeFlatNode)
+                    + triangles.bytes();
+    os<<"kd-tree nodes: "<<flatNodes.size()<<" ("<<leaves<<" leaves, "
+      <<sizeof(AmKDTreeFlatNode)<<" bytes per node)"<<endl;
+    os<<"kd-tree leaf meshes: "<<meshes<<" ("
+      <<(leaves ? 1.0 * meshes / leaves : 0)<<" per leaf, "
+      <<triangles.size() - meshes<<" padding for "<<AM_SIMD_WIDTH
+      <<"-wide vectors)"<<endl;
+    os<<"kd-tree memory: "<<bytes<<" bytes"<<endl;
+    os<<"kd-tree build: "<<buildTime<<" s"
+      <<(cached ? " (loaded from the cache)" : "")<<endl;
+}
+
+
+///// kd-tree cache ///////
+
+// head of a cache file, followed by the flat nodes, the 9 float arrays
+//  of the triangle buffer and its meshes, in the layout of the traversal
+struct AmKDTreeCacheHeader
+{
+    char                magic[8];       // "AMKDTREE"
+    unsigned int        version;
+    unsigned int        simdWidth;      // the leaves are padded to it
+    unsigned long long  key;
+    unsigned int        modelTriangles;
+    unsigned int        nodeCount;
+    unsigned int        triangleCount;  // of the buffer, with the padding
+    float               box[6];
+    unsigned int        reserved;
+};
+
+unsigned long long AmKDTree::cacheKey() const
+{
+    unsigned long long hash = CommonFuncs::hashFNV(0, 0);
+    string files[2] = {model->getPathname(), model->getMtlPathname()};
+    for (int i = 0; i < 2; i++) {
+        AmMappedFile file;
+        if (!files[i].empty() && file.open(files[i])) {
+            hash = CommonFuncs::hashFNV(file.data(), file.size(), hash);
+        }
+    }
+    
+    int params[4] = {static_cast<int>(CACHE_VERSION), AM_SIMD_WIDTH,
+                     static_cast<int>(heuristic),
+                     static_cast<int>(model->mTriangles.size())};
+    hash = CommonFuncs::hashFNV(params, sizeof(params), hash);
+    unsigned long long edits = model->editHash();
+    return CommonFuncs::hashFNV(&edits, sizeof(edits), hash);
+}
+
+void AmKDTree::initCached(const string &dir)
+{
+    AmTimer timer;
+    unsigned long long key = cacheKey();
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.kdtree", key);
+    string filename = dir + "/" + name;
+    
+    if (load(filename, key)) {
+        buildTime = timer.elapsed();
+        return;
+    }
+    init();
+    save(filename, key);
+}
+
+bool AmKDTree::save(const string &filename, unsigned long long key) const
+{
+    AmKDTreeCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "AMKDTREE", 8);
+    header.version = CACHE_VERSION;
+    header.simdWidth = AM_SIMD_WIDTH;
+    header.key = key;
+    header.modelTriangles = static_cast<unsigned int>(model->mTriangles.size());
+    header.nodeCount = static_cast<unsigned int>(flatNodes.size());
+    header.triangleCount = static_cast<unsigned int>(triangles.size());
+    for (int axis = 0; axis < 3; axis++) {
+        header.box[axis] = boxStart.mData[axis];
+        header.box[axis + 3] = boxEnd.mData[axis];
+    }
+    
+    // write to a temporary file of this process and rename it, so a
+    //  concurrent run never maps a half written cache nor writes into
+    //  the same temporary file
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%ld.tmp",
+             static_cast<long>(getpid()));
+    string temp = filename + suffix;
+    {
+        ofstream ofs(temp.c_str(), ios::binary);
+        if (!ofs) {
+            return false;
+        }
+        ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        ofs.write(reinterpret_cast<const char *>(flatNodes.data()),
+                  flatNodes.size() * sizeof(AmKDTreeFlatNode));
+        const AmArray<float> *arrays[] = {&triangles.v0x, &triangles.v0y,
+            &triangles.v0z, &triangles.e1x, &triangles.e1y, &triangles.e1z,
+            &triangles.e2x, &triangles.e2y, &triangles.e2z};
+        for (int i = 0; i < 9; i++) {
+            ofs.write(reinterpret_cast<const char *>(arrays[i]->data()),
+                      arrays[i]->size() * sizeof(float));
+        }
+        ofs.write(reinterpret_cast<const char *>(triangles.meshes.data()),
+                  triangles.meshes.size() * sizeof(int));
+        if (!ofs) {
+            remove(temp.c_str());
+            return false;
+        }
+    }
+    return rename(temp.c_str(), filename.c_str()) == 0;
+}
+
+// the file is mapped and the traversal arrays view its sections in
+//  place, they have the same layout. cacheFile must outlive the views,
+//  so they are dropped before the file is opened again
+bool AmKDTree::load(const string &filename, unsigned long long key)
+{
+    flatNodes.clear();
+    triangles.clear();
+    cached = false;
+    
+    // copy on write, like the scene file, so the arrays can still be
+    //  changed after loading
+    if (!cacheFile.open(filename, true)
+        || cacheFile.size() < sizeof(AmKDTreeCacheHeader)) {
+        cacheFile.close();
+        return false;
+    }
+    
+    AmKDTreeCacheHeader header;
+    memcpy(&header, cacheFile.data(), sizeof(header));
+    size_t n = header.nodeCount, m = header.triangleCount;
+    size_t expected = sizeof(header) + n * sizeof(AmKDTreeFlatNode)
+                        + m * (9 * sizeof(float) + sizeof(int));
+    if (memcmp(header.magic, "AMKDTREE", 8) != 0
+        || header.version != CACHE_VERSION
+        || header.simdWidth != AM_SIMD_WIDTH
+        || header.key != key
+        || header.modelTriangles != model->mTriangles.size()
+        || n == 0 || cacheFile.size() != expected) {
+        cacheFile.close();
+        return false;
+    }
+    
+    // the header, the nodes and the arrays are all multiples of 4 bytes,
+    //  so every array starts aligned for its elements
+    char *data = cacheFile.data() + sizeof(header);
+    AmKDTreeFlatNode *nodesData = reinterpret_cast<AmKDTreeFlatNode *>(data);
+    data += n * sizeof(AmKDTreeFlatNode);
+    AmArray<float> *arrays[] = {&triangles.v0x, &triangles.v0y,
+        &triangles.v0z, &triangles.e1x, &triangles.e1y, &triangles.e1z,
+        &triangles.e2x, &triangles.e2y, &triangles.e2z};
+    float *values[9];
+    for (int i = 0; i < 9; i++) {
+        values[i] = reinterpret_cast<float *>(data);
+        data += m * sizeof(float);
+    }
+    int *meshes = reinterpret_cast<int *>(data);
+    
+    // don't trust the indices of the file, nor its depth which bounds
+    //  the traversal stacks
+    vector<int> depth(n, 0);
+    for (size_t i = 0; i < n; i++) {
+        const AmKDTreeFlatNode &node = nodesData[i];
+        if (node.leaf()) {
+            if (size_t(node.offset) + node.count() > m) {
+                cacheFile.close();
+                return false;
+            }
+            continue;
+        }
+        if (node.rightChild() <= i + 1 || node.rightChild() >= n
+            || depth[i] >= MAX_DEPTH) {
+            cacheFile.close();
+            return false;
+        }
+        depth[i + 1] = depth[node.rightChild()] = depth[i] + 1;
+    }
+    for (size_t i = 0; i < m; i++) {
+        if (meshes[i] < -1
+            || meshes[i] >= static_cast<int>(model->mTriangles.size())) {
+            cacheFile.close();
+            return false;
+        }
+    }
+    
+    nodes.clear();
+    flatNodes.view(nodesData, n);
+    for (int i = 0; i < 9; i++) {
+        arrays[i]->view(values[i], m);
+    }
+    triangles.meshes.view(meshes, m);
+    boxStart = AmVec3f(header.box[0], header.box[1], header.box[2]);
+    boxEnd = AmVec3f(header.box[3], header.box[4], header.box[5]);
+    cached = true;
+    return true;
+}
+
+// depth-first search to build the tree
+void AmKDTree::buildNode(vector<AmKDTreeNodePtr> &tree, int index)
+{
+    while (index != -1) {
+        if (terminate(tree[index])) {
+            tree[index]->leaf = true;
+            tree[index]->freeEvents();
+        } else {
+            splitNode(tree, index);
+        }
+        
+        if (tree[index]->leftChild != -1) {
+            index = tree[index]->leftChild;
+            continue;
+        } else if (tree[index]->sibling != -1) {
+            index = tree[index]->sibling;
+            continue;
+        } else {
+            while (tree[index]->parent != -1) {
+                index = tree[index]->parent;
+                if (tree[index]->sibling != -1) {
+                    index = tree[index]->sibling;
+                    break;
+                }
+            }
+            if (tree[index]->parent == -1) {
+                index = -1;
+            }
+        }
+    }
+}
+
+// build the top levels of the tree breadth-first, then the subtrees
+//  below them as tasks on the pool, each one into its own node vector.
+//  A node only depends on its box, depth and meshes, so the tree is the
+//  same as the one of the serial build
+void AmKDTree::buildParallel()
+{
+    // several subtrees per thread, the work stealing evens them out
+    int topDepth = 0;
+    while ((1 << topDepth) < pool->size() * 4 && topDepth < maxDepth) {
+        topDepth++;
+    }
+    
+    vector<int> frontier(1, 0);
+    for (int depth = 0; depth < topDepth && !frontier.empty(); depth++) {
+        vector<int> next;
+        for (size_t i = 0; i < frontier.size(); i++) {
+            int index = frontier[i];
+            if (terminate(nodes[index])) {
+                nodes[index]->leaf = true;
+                nodes[index]->freeEvents();
+            } else {
+                splitNode(nodes, index);
+                next.push_back(nodes[index]->leftChild);
+                next.push_back(nodes[index]->rightChild);
+            }
+        }
+        frontier.swap(next);
+    }
+    
+    // every subtree starts from a copy of its root cut from the tree
+    vector<vector<AmKDTreeNodePtr> > subtrees(frontier.size());
+    vector<AmThreadPool::AmTask> tasks;
+    for (size_t i = 0; i < frontier.size(); i++) {
+        AmKDTreeNodePtr root(new AmKDTreeNode(*nodes[frontier[i]]));
+        root->parent = root->sibling = -1;
+        subtrees[i].push_back(root);
+        vector<AmKDTreeNodePtr> *subtree = &subtrees[i];
+        tasks.push_back([this, subtree](int) {
+            buildNode(*subtree, 0);
+        });
+    }
+    pool->run(tasks);
+    
+    // append the subtrees, the local index k > 0 becomes offset + k
+    for (size_t i = 0; i < frontier.size(); i++) {
+        vector<AmKDTreeNodePtr> &subtree = subtrees[i];
+        int root = frontier[i];
+        int offset = static_cast<int>(nodes.size()) - 1;
+        for (size_t k = 0; k < subtree.size(); k++) {
+            AmKDTreeNodePtr node = subtree[k];
+            if (node->leftChild != -1) {
+                node->leftChild += offset;
+                node->rightChild += offset;
+            }
+            if (k == 0) {
+                // the root keeps its place and its links to the top
+                node->parent = nodes[root]->parent;
+                node->sibling = nodes[root]->sibling;
+                nodes[root] = node;
+                continue;
+            }
+            node->parent = (node->parent == 0) ? root : node->parent + offset;
+            if (node->sibling != -1) {
+                node->sibling += offset;
+            }
+            nodes.push_back(node);
+        }
+    }
+}
+
+// check if need to terminate the splittion
+bool AmKDTree::terminate(const AmKDTreeNodePtr &node)
+{
+    if (heuristic == AM_SAH) {
+        if (node->depth >= maxDepth
+            || node->meshes.size() <= 1) {
+            return true;
+        }
+        // the plane is kept in the node for splitNode
+        return !findPlaneSAH(node);
+    }
+    
+    if(node->depth == 16)
+	{// maximum depth of 16
+		return true;
+	}
+	if(node->meshes.size() <= 5)
+    {// the number of meshes in the node is small enough
+		return true;
+	}
+    return false;
+}
+
+
+// split the node
+void AmKDTree::splitNode(vector<AmKDTreeNodePtr> &tree, int index)
+{
+    //first choose the plane to split, the SAH did it in terminate
+    if (heuristic == AM_MEDIAN) {
+        findPlane(tree[index]);
+    }
+    
+    //get the index of the children
+    tree[index]->leftChild = static_cast<int>(tree.size());
+    tree.push_back(AmKDTreeNodePtr(new AmKDTreeNode));
+    tree[index]->rightChild = static_cast<int>(tree.size());
+    tree.push_back(AmKDTreeNodePtr(new AmKDTreeNode));
+    
+    AmKDTreeNodePtr thenode = tree[index];
+    AmKDTreeNodePtr left = tree[thenode->leftChild];
+    AmKDTreeNodePtr right = tree[thenode->rightChild];
+    
+    left->sibling = thenode->rightChild;
+    left->parent = right->parent = index;
+    left->depth = right->depth = thenode->depth + 1;
+	
+	left->start = thenode->start;
+    left->end = thenode->end;
+    right->start = thenode->start;
+    right->end = thenode->end;
+	if(thenode->plane.axis == AmPlane::AM_X)
+	{
+        left->end.mData[0] = right->start.mData[0] = thenode->plane.value;
+	} else if(thenode->plane.axis == AmPlane::AM_Y)
+	{
+        left->end.mData[1] = right->start.mData[1] = thenode->plane.value;
+	} else {
+        left->end.mData[2] = right->start.mData[2] = thenode->plane.value;
+	}
+    
+	// split the triangles
+	for(int i = 0; i < thenode->meshes.size(); i++)
+	{// check the triangles in parent node
+		int parentMesh = thenode->meshes[i];
+        
+		int position = meshInNode(parentMesh, thenode);
+		if(position <= 0)
+		{// in left child
+			left->meshes.push_back(parentMesh);
+            left->addMeshBound(model->mTriangles[parentMesh]);
+		}
+        if (position >= 0)
+        {// in right child
+			right->meshes.push_back(parentMesh);
+            right->addMeshBound(model->mTriangles[parentMesh]);
+		}
+	}
+    
+    // split the sorted events the same way, filtering keeps them sorted
+    for (int axis = 0; axis < 3 && heuristic == AM_SAH; axis++) {
+        vector<AmKDTreeEvent> *from[2] = {&thenode->startEvents[axis],
+                                          &thenode->endEvents[axis]};
+        vector<AmKDTreeEvent> *toLeft[2] = {&left->startEvents[axis],
+                                            &left->endEvents[axis]};
+        vector<AmKDTreeEvent> *toRight[2] = {&right->startEvents[axis],
+                                             &right->endEvents[axis]};
+        for (int k = 0; k < 2; k++) {
+            toLeft[k]->reserve(left->meshes.size());
+            toRight[k]->reserve(right->meshes.size());
+            for (size_t i = 0; i < from[k]->size(); i++) {
+                const AmKDTreeEvent &event = (*from[k])[i];
+                int position = meshInNode(event.mesh, thenode);
+                if (position <= 0) {
+                    toLeft[k]->push_back(event);
+                }
+                if (position >= 0) {
+                    toRight[k]->push_back(event);
+                }
+            }
+        }
+    }
+    
+    // only the leaves need their meshes
+    thenode->freeEvents();
+    vector<int>().swap(thenode->meshes);
+}
+
+// find the plane to split the node
+//  first check if blank space is too large in one axis,
+//  if not, choose the axis of the largest span to split
+void AmKDTree::findPlane(const AmKDTreeNodePtr &node)
+{
+    // bounds of the meshes, collected when the parent was split
+    const AmVec3f &vmax = node->meshEnd;
+    const AmVec3f &vmin = node->meshStart;
+    float xspan = node->end.x() - node->start.x();
+	if((vmin.x() - node->start.x()) / xspan > 0.25)
+	{// blank space of x axis from start is too much
+		node->plane.axis = AmPlane::AM_X;
+		node->plane.value = vmin.x();
+		return;
+	} else if((node->end.x() - vmax.x()) / xspan > 0.25)
+	{// blank space of x axis from end is too much
+		node->plane.axis = AmPlane::AM_X;
+		node->plane.value = vmax.x();
+		return;
+	}
+    
+	float yspan = node->end.y() - node->start.y();
+	if((vmin.y() - node->start.y()) / xspan > 0.25)
+	{// blank space of y axis from start is too much
+		node->plane.axis = AmPlane::AM_Y;
+		node->plane.value = vmin.y();
+		return;
+	} else if((node->end.y() - vmax.y()) / yspan > 0.25)
+	{// blank space of y axis from end is too much
+		node->plane.axis = AmPlane::AM_Y;
+		node->plane.value = vmax.y();
+		return;
+	}
+    
+	float zspan = node->end.z() - node->start.z();
+	if((vmin.z() - node->start.z()) / zspan > 0.25)
+	{// blank space of z axis from start is too much
+		node->plane.axis = AmPlane::AM_Z;
+		node->plane.value = vmin.z();
+		return;
+	} else if((node->end.z() - vmax.z()) / zspan > 0.25)
+	{// blank space of z axis from end is too much
+		node->plane.axis = AmPlane::AM_Z;
+		node->plane.value = vmax.z();
+		return;
+	}
+    
+	// find the spacial median of the longest axis
+	if(xspan > yspan)
+	{
+		if(xspan > zspan)
+			node->plane.axis = AmPlane::AM_X;
+		else
+			node->plane.axis = AmPlane::AM_Z;
+	} else {
+		if(yspan > zspan)
+			node->plane.axis = AmPlane::AM_Y;
+		else
+			node->plane.axis = AmPlane::AM_Z;
+	}
+    
+	if(node->plane.axis == AmPlane::AM_X)
+		node->plane.value =
+            (node->start.x() + node->end.x()) * 0.5;
+	else if(node->plane.axis == AmPlane::AM_Y)
+		node->plane.value =
+            (node->start.y() + node->end.y()) * 0.5;
+	else
+		node->plane.value =
+            (node->start.z() + node->end.z()) * 0.5;
+}
+
+// find the plane of the lowest cost by the surface area heuristic,
+//  the candidates are the bounds of the meshes in the node.
+//  For a plane p on an axis, the meshes that start at or before p go left,
+//  the ones that end at or after p go right (some go to both sides).
+//  Return false if no split is cheaper than keeping the node as a leaf
+bool AmKDTree::findPlaneSAH(const AmKDTreeNodePtr &thenode)
+{
+    int n = static_cast<int>(thenode->meshes.size());
+    AmVec3f size = thenode->end - thenode->start;
+    
+    // half surface area, the factor 2 cancels out in the ratios
+    float area = size.x()*size.y() + size.y()*size.z() + size.z()*size.x();
+    if (area <= 0) {
+        return false;
+    }
+    
+    float bestCost = SAH_INTERSECT * n;  // cost of a leaf
+    bool found = false;
+    for (int axis = 0; axis < 3; axis++) {
+        float lo = thenode->start.mData[axis];
+        float hi = thenode->end.mData[axis];
+        if (hi - lo <= 0) {
+            continue;
+        }
+        
+        // the other two edges of the box
+        float a = size.mData[(axis + 1) % 3];
+        float b = size.mData[(axis + 2) % 3];
+        
+        // sweep the candidates in increasing order, the events of the
+        //  node are already sorted
+        const vector<AmKDTreeEvent> &starts = thenode->startEvents[axis];
+        const vector<AmKDTreeEvent> &ends = thenode->endEvents[axis];
+        int i = 0, j = 0;
+        while (i < n || j < n) {
+            float p = (j >= n || (i < n && starts[i].pos < ends[j].pos))
+                        ? starts[i].pos : ends[j].pos;
+            while (i < n && starts[i].pos <= p) {
+                i++;
+            }
+            int nLeft = i;
+            int nRight = n - j;     // ends before p are all consumed
+            while (j < n && ends[j].pos <= p) {
+                j++;
+            }
+            
+            if (p <= lo || p >= hi) {
+                continue;
+            }
+            
+            float areaLeft = a*b + (p - lo)*(a + b);
+            float areaRight = a*b + (hi - p)*(a + b);
+            float bonus = (nLeft == 0 || nRight == 0) ? SAH_EMPTY_BONUS : 0;
+            float cost = SAH_TRAVERSAL + SAH_INTERSECT * (1 - bonus)
+                        * (areaLeft * nLeft + areaRight * nRight) / area;
+            if (cost < bestCost) {
+                bestCost = cost;
+                found = true;
+                thenode->plane.axis = static_cast<AmPlane::AmAxis>(axis);
+                thenode->plane.value = p;
+            }
+        }
+    }
+    return found;
+}
+
+// check what node the mesh is in
+// return -1 means left, 1 means right and 0 means both
+int AmKDTree::meshInNode(int mesh, const AmKDTreeNodePtr &node)
+{
+    float value = node->plane.value;
+    AmTriangle* m = &model->mTriangles[mesh];
+	if(node->plane.axis == AmPlane::AM_X)
+    {
+		if(m->end.x() < value-EPSILON)
+			return -1;
+		else if(m->start.x() > value+EPSILON)
+			return 1;
+		else
+			return 0;
+	} else if(node->plane.axis == AmPlane::AM_Y)
+	{
+		if(m->end.y() < value-EPSILON)
+			return -1;
+		else if(m->start.y() > value+EPSILON)
+			return 1;
+		else
+			return 0;
+	} else {
+		if(m->end.z() < value-EPSILON)
+			return -1;
+		else if(m->start.z() > value+EPSILON)
+			return 1;
+		else
+			return 0;
+	}
+}
+
+
+
+///// kd-tree traversal ///////
+
+// search for intersection
+float AmKDTree::search(const AmRay &ray, int &index) const
+{
+    float hit = -1;
+    index = -1;
+    AmTraversalCounts counts;
+    
+    // check the box intersection
+	float tmin, tmax;
+	if(!hitBox(ray, tmin, tmax))
+		return hit;
+    
+    // the far children and their intervals, one per level at most
+    unsigned int stack[MAX_DEPTH];
+    float tstack[MAX_DEPTH * 2];
+    int top = 0;
+    unsigned int node = 0;
+	while(1)
+	{
+        const AmKDTreeFlatNode &thenode = flatNodes[node];
+		if(thenode.leaf())
+		{// hit the leaf
+            counts.leaves++;
+            counts.tests += thenode.count();
+			int leafIndex;
+			float leafHit;
+			if(searchLeaf(thenode, ray, leafIndex, leafHit)
+               && (hit < 0 || leafHit < hit))
+			{
+				hit = leafHit;
+				index = leafIndex;
+			}
+			// a mesh may cross the leaf and be hit behind it, then a
+			//  nearer hit can still be found in the following leaves
+			if(hit > 0 && hit <= tmax+EPSILON)
+				return hit;
+			else if(top > 0)
+			{//push node from stack
+                top--;
+				node = stack[top];
+                tmin = tstack[2 * top];
+                tmax = tstack[2 * top + 1];
+			}
+			else
+				return hit;
+		} else {
+            counts.nodes++;
+            int axis = thenode.axis();
+            // left and right child, the near one is picked by the sign
+            unsigned int children[2] = {node + 1, thenode.rightChild()};
+            
+            if(ray.dir.mData[axis] == 0)
+            {// parallel to the plane, stay on the side of the origin
+                node = children[ray.orig.mData[axis] > thenode.split];
+                continue;
+            }
+            
+			float tHit = (thenode.split - ray.orig.mData[axis])
+                            * ray.invDir.mData[axis];
+			unsigned int first = children[ray.sign[axis]];
+            unsigned int second = children[1 - ray.sign[axis]];
+            
+			if(tHit > tmax+EPSILON)
+				node = first;
+			else if(tHit < tmin-EPSILON) //including the condition that tHit<0
+				node = second;
+			else
+			{ // through both children, push the second to stack
+                stack[top] = second;
+                tstack[2 * top] = tHit;
+                tstack[2 * top + 1] = tmax;
+                top++;
+				tmax = tHit;
+				node = first;
+			}
+		}
+	}
+	return hit;
+}
+
+
+// any hit, the traversal of search() limited to the segment
+//  [tmin, tLimit] of the ray, stop at the first blocking mesh
+bool AmKDTree::occluded(const AmRay &ray, float tLimit, int ignore) const
+{
+    float tmin, tmax;
+    if(!hitBox(ray, tmin, tmax) || tmin > tLimit)
+        return false;
+    // the nodes beyond the light are never visited
+    tmax = min(tmax, tLimit);
+    AmTraversalCounts counts;
+    
+    unsigned int stack[MAX_DEPTH];
+    float tstack[MAX_DEPTH * 2];
+    int top = 0;
+    unsigned int node = 0;
+    while(1)
+    {
+        const AmKDTreeFlatNode &thenode = flatNodes[node];
+        if(thenode.leaf())
+        {
+            counts.leaves++;
+            counts.tests += thenode.count();
+            // any hit before the light blocks it, even one outside the leaf
+            if(triangles.any(thenode.offset, thenode.offset + thenode.count(),
+                             ray, tLimit, ignore))
+                return true;
+            if(top == 0)
+                return false;
+            top--;
+            node = stack[top];
+            tmin = tstack[2 * top];
+            tmax = tstack[2 * top + 1];
+        } else {
+            counts.nodes++;
+            int axis = thenode.axis();
+            unsigned int children[2] = {node + 1, thenode.rightChild()};
+            
+            if(ray.dir.mData[axis] == 0)
+            {// parallel to the plane, stay on the side of the origin
+                node = children[ray.orig.mData[axis] > thenode.split];
+                continue;
+            }
+            
+            float tHit = (thenode.split - ray.orig.mData[axis])
+                            * ray.invDir.mData[axis];
+            unsigned int first = children[ray.sign[axis]];
+            unsigned int second = children[1 - ray.sign[axis]];
+            
+            if(tHit > tmax+EPSILON)
+                node = first;
+            else if(tHit < tmin-EPSILON)
+                node = second;
+            else
+            {
+                stack[top] = second;
+                tstack[2 * top] = tHit;
+                tstack[2 * top + 1] = tmax;
+                top++;
+                tmax = tHit;
+                node = first;
+            }
+        }
+    }
+}
+
+
+// packet traversal, a vector of AM_SIMD_WIDTH rays per step. Every ray
+//  keeps its own interval and lane mask, and takes the same decisions as
+//  in search(), so the results are the same; the packet only visits the
+//  union of the nodes its rays would visit
+void AmKDTree::searchPacket(const AmRayPacket &packet,
+                            float *hits, int *indices) const
+{
+#if AM_SIMD_WIDTH > 1
+    for (int axis = 0; axis < 3; axis++) {
+        bool positive = packet.dir[axis][0] > 0;
+        for (int i = 0; i < packet.size; i++) {
+            if (packet.dir[axis][i] == 0
+                || (packet.dir[axis][i] > 0) != positive) {
+                // diverged, the rays go through the children in
+                //  different orders
+                AmAccelerator::searchPacket(packet, hits, indices);
+                return;
+            }
+        }
+    }
+    
+    const int W = AM_SIMD_WIDTH;
+    const int G = (AmRayPacket::MAX_SIZE + W - 1) / W;
+    int groups = (packet.size + W - 1) / W;
+    
+    // intervals of the rays in the root box
+    float lo[G * W], hi[G * W], live[G * W];
+    for (int i = 0; i < G * W; i++) {
+        lo[i] = hi[i] = live[i] = 0;
+        if (i < packet.size && hitBox(packet.ray(i), lo[i], hi[i])) {
+            live[i] = 1;
+        }
+    }
+    
+    const AmFloatV zero = vSet1(0), one = vSet1(1), eps = vSet1(EPSILON);
+    AmFloatV ox[G], oy[G], oz[G], dx[G], dy[G], dz[G], inv[3][G];
+    AmFloatV tmin[G], tmax[G], active[G], finished[G], best[G], bestIndex[G];
+    int any = 0;
+    for (int g = 0; g < groups; g++) {
+        ox[g] = vLoad(&packet.orig[0][g * W]);
+        oy[g] = vLoad(&packet.orig[1][g * W]);
+        oz[g] = vLoad(&packet.orig[2][g * W]);
+        dx[g] = vLoad(&packet.dir[0][g * W]);
+        dy[g] = vLoad(&packet.dir[1][g * W]);
+        dz[g] = vLoad(&packet.dir[2][g * W]);
+        inv[0][g] = vDiv(one, dx[g]);
+        inv[1][g] = vDiv(one, dy[g]);
+        inv[2][g] = vDiv(one, dz[g]);
+        tmin[g] = vLoad(&lo[g * W]);
+        tmax[g] = vLoad(&hi[g * W]);
+        active[g] = vNE(vLoad(&live[g * W]), zero);
+        finished[g] = zero;
+        best[g] = vSet1(-1);
+        bestIndex[g] = vSet1i(-1);
+        any |= vMask(active[g]);
+    }
+    
+    // the second children and the rays going through them
+    struct {
+        unsigned int    node;
+        AmFloatV        tmin[G], tmax[G], active[G];
+    } stack[MAX_DEPTH];
+    int top = 0;
+    unsigned int node = 0;
+    AmTraversalCounts counts;
+    while (any) {
+        const AmKDTreeFlatNode &thenode = flatNodes[node];
+        if (thenode.leaf()) {
+            counts.leaves++;
+            counts.tests += thenode.count() * packet.size;
+            unsigned int end = thenode.offset + thenode.count();
+            for (unsigned int i = thenode.offset; i < end; i++) {
+                if (triangles.meshes[i] < 0) {
+                    break;  // padding of the leaf
+                }
+                AmFloatV ax = vSet1(triangles.e1x[i]);
+                AmFloatV ay = vSet1(triangles.e1y[i]);
+                AmFloatV az = vSet1(triangles.e1z[i]);
+                AmFloatV bx = vSet1(triangles.e2x[i]);
+                AmFloatV by = vSet1(triangles.e2y[i]);
+                AmFloatV bz = vSet1(triangles.e2z[i]);
+                AmFloatV cx = vSet1(triangles.v0x[i]);
+                AmFloatV cy = vSet1(triangles.v0y[i]);
+                AmFloatV cz = vSet1(triangles.v0z[i]);
+                AmFloatV mesh = vSet1i(triangles.meshes[i]);
+                for (int g = 0; g < groups; g++) {
+                    if (vMask(active[g]) == 0) {
+                        continue;
+                    }
+                    // one triangle against a vector of rays, the same
+                    //  steps as AmTriangleBuffer::hit()
+                    AmFloatV px = vSub(vMul(dy[g], bz), vMul(dz[g], by));
+                    AmFloatV py = vSub(vMul(dz[g], bx), vMul(dx[g], bz));
+                    AmFloatV pz = vSub(vMul(dx[g], by), vMul(dy[g], bx));
+                    AmFloatV det = vAdd(vAdd(vMul(ax, px), vMul(ay, py)),
+                                        vMul(az, pz));
+                    AmFloatV inv = vDiv(one, det);
+                    
+                    AmFloatV tx = vSub(ox[g], cx);
+                    AmFloatV ty = vSub(oy[g], cy);
+                    AmFloatV tz = vSub(oz[g], cz);
+                    AmFloatV u = vMul(vAdd(vAdd(vMul(tx, px), vMul(ty, py)),
+                                           vMul(tz, pz)), inv);
+                    
+                    AmFloatV qx = vSub(vMul(ty, az), vMul(tz, ay));
+                    AmFloatV qy = vSub(vMul(tz, ax), vMul(tx, az));
+                    AmFloatV qz = vSub(vMul(tx, ay), vMul(ty, ax));
+                    AmFloatV v = vMul(vAdd(vAdd(vMul(dx[g], qx),
+                                                vMul(dy[g], qy)),
+                                           vMul(dz[g], qz)), inv);
+                    AmFloatV t = vMul(vAdd(vAdd(vMul(bx, qx), vMul(by, qy)),
+                                           vMul(bz, qz)), inv);
+                    
+                    AmFloatV mask = vAnd(vAnd(active[g], vNE(det, zero)),
+                                         vAnd(vGE(u, zero), vLE(u, one)));
+                    mask = vAnd(mask, vAnd(vGE(v, zero),
+                                           vLE(vAdd(u, v), one)));
+                    mask = vAnd(mask, vAnd(vGT(t, eps),
+                                           vOr(vLT(best[g], zero),
+                                               vLT(t, best[g]))));
+                    best[g] = vSelect(mask, t, best[g]);
+                    bestIndex[g] = vSelect(mask, mesh, bestIndex[g]);
+                }
+            }
+            
+            // a ray is finished once its hit is inside the leaf
+            for (int g = 0; g < groups; g++) {
+                AmFloatV inside = vAnd(vGT(best[g], zero),
+                                       vLE(best[g], vAdd(tmax[g], eps)));
+                finished[g] = vOr(finished[g], vAnd(active[g], inside));
+            }
+            
+            // pop until a node with unfinished rays
+            any = 0;
+            while (top > 0 && any == 0) {
+                top--;
+                node = stack[top].node;
+                for (int g = 0; g < groups; g++) {
+                    tmin[g] = stack[top].tmin[g];
+                    tmax[g] = stack[top].tmax[g];
+                    active[g] = vAndNot(finished[g], stack[top].active[g]);
+                    any |= vMask(active[g]);
+                }
+            }
+        } else {
+            counts.nodes++;
+            int axis = thenode.axis();
+            unsigned int first = node + 1;
+            unsigned int second = thenode.rightChild();
+            if (packet.dir[axis][0] < 0) {
+                swap(first, second);
+            }
+            
+            AmFloatV split = vSet1(thenode.split);
+            AmFloatV firstActive[G], secondActive[G], firstMax[G], secondMin[G];
+            int needFirst = 0, needSecond = 0;
+            for (int g = 0; g < groups; g++) {
+                AmFloatV tHit = vMul(vSub(split, vLoad(&packet.orig[axis][g * W])),
+                                     inv[axis][g]);
+                AmFloatV onlyFirst = vGT(tHit, vAdd(tmax[g], eps));
+                AmFloatV onlySecond = vAndNot(onlyFirst,
+                                              vLT(tHit, vSub(tmin[g], eps)));
+                firstActive[g] = vAndNot(onlySecond, active[g]);
+                secondActive[g] = vAndNot(onlyFirst, active[g]);
+                
+                // the rays through both children split their intervals
+                AmFloatV both = vAnd(firstActive[g], secondActive[g]);
+                firstMax[g] = vSelect(both, tHit, tmax[g]);
+                secondMin[g] = vSelect(both, tHit, tmin[g]);
+                needFirst |= vMask(firstActive[g]);
+                needSecond |= vMask(secondActive[g]);
+            }
+            
+            if (needFirst && needSecond) {
+                stack[top].node = second;
+                for (int g = 0; g < groups; g++) {
+                    stack[top].tmin[g] = secondMin[g];
+                    stack[top].tmax[g] = tmax[g];
+                    stack[top].active[g] = secondActive[g];
+                }
+                top++;
+            }
+            if (needFirst) {
+                node = first;
+                for (int g = 0; g < groups; g++) {
+                    tmax[g] = firstMax[g];
+                    active[g] = firstActive[g];
+                }
+            } else {
+                node = second;
+                for (int g = 0; g < groups; g++) {
+                    tmin[g] = secondMin[g];
+                    active[g] = secondActive[g];
+                }
+            }
+        }
+    }
+    
+    float hitOut[G * W], indexOut[G * W];
+    for (int g = 0; g < groups; g++) {
+        vStore(&hitOut[g * W], best[g]);
+        vStore(&indexOut[g * W], bestIndex[g]);
+    }
+    for (int i = 0; i < packet.size; i++) {
+        hits[i] = hitOut[i];
+        memcpy(&indices[i], &indexOut[i], sizeof(int));
+    }
+#else
+    AmAccelerator::searchPacket(packet, hits, indices);
+#endif
+}
+
+
+// slab test against the root box, the sign of the direction picks the
+//  near and far planes so there is no swap. Written so that a NaN (ray
+//  on a plane of the box) keeps the old value
+bool AmKDTree::hitBox(const AmRay &ray, float &tmin, float &tmax) const
+{
+    const AmVec3f *bounds[2] = {&boxStart, &boxEnd};
+    tmin = M_MIN;
+    tmax = M_MAX;
+    for (int axis = 0; axis < 3; axis++) {
+        int s = ray.sign[axis];
+        float t1 = (bounds[s]->mData[axis] - ray.orig.mData[axis])
+                    * ray.invDir.mData[axis];
+        float t2 = (bounds[1 - s]->mData[axis] - ray.orig.mData[axis])
+                    * ray.invDir.mData[axis];
+        tmin = t1 > tmin ? t1 : tmin;
+        tmax = t2 < tmax ? t2 : tmax;
+    }
+    // the box is behind, or missed
+    return tmax >= 0 && tmax - tmin >= -EPSILON;
+}
+
+bool AmKDTree::searchLeaf(const AmKDTreeFlatNode &node, const AmRay &ray,
+                          int &index, float &minHit) const
+{
+    size_t slot = 0;
+    minHit = triangles.nearest(node.offset, node.offset + node.count(),
+                               ray, slot);
+    index = (minHit > 0) ? triangles.meshes[slot] : -1;
+    return minHit > 0;
+}
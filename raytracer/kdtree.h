@@ -0,0 +1,289 @@
+//
+//  kdtree.h
+//  raytracer
+//
+//  kd-tree to accelerate the tracing
+//
+//  Created by ambling on 13-5-20.
+//  Copyright (c) 2013年 ambling. All rights reserved.
+//
+
+#ifndef raytracer_kdtree_h
+#define raytracer_kdtree_h
+
+#include "utils.h"
+#include "accel.h"
+#include "mapfile.h"
+#include "threadpool.h"
+
+using namespace std;
+
+namespace raytracer {
+    
+    
+    /*
+     * space plane for kd-tree
+     */
+    class AmPlane
+    {
+    public:
+        enum AmAxis{AM_X, AM_Y, AM_Z};
+        
+        AmAxis  axis;
+        float   value;
+        int     index;
+        
+        AmPlane()
+        :axis(AM_X), value(0), index(0)
+        {}
+    };
+    
+    
+    /*
+     * bound of a mesh on one axis, the builder keeps the events of a node
+     *  sorted by position, so no node has to sort its meshes again
+     */
+    class AmKDTreeEvent
+    {
+    public:
+        float   pos;
+        int     mesh;
+        
+        bool operator < (const AmKDTreeEvent &rhs) const
+        {
+            return pos < rhs.pos || (pos == rhs.pos && mesh < rhs.mesh);
+        }
+    };
+    
+    
+    /*
+     * kd-tree node
+     */
+    class AmKDTreeNode
+    {
+    public:
+        int     parent;         // index of the parent in tree node vector
+        int     leftChild;      // index of left child
+        int     rightChild;     // index of right child
+        int     sibling;        // index of sibling
+        
+        bool    leaf;           // is leaf or not
+        int     depth;
+        AmVec3f start;          // start of bounding box
+        AmVec3f end;            // end of bounding box
+        AmVec3f meshStart;      // bounding box of the meshes in the node,
+        AmVec3f meshEnd;        //  found while the parent is split
+        
+        AmPlane plane;
+        vector<int> meshes;     //the indices of meshes in this node
+        
+        // the starts and the ends of the meshes on each axis, sorted,
+        //  only kept until the node is split or made a leaf, and only
+        //  by the SAH builder
+        vector<AmKDTreeEvent> startEvents[3];
+        vector<AmKDTreeEvent> endEvents[3];
+        
+        AmKDTreeNode()
+        :start(0,0,0), end(0,0,0),
+        meshStart(M_MAX, M_MAX, M_MAX), meshEnd(M_MIN, M_MIN, M_MIN)
+        {
+            parent = leftChild = rightChild = sibling = -1;
+            leaf = false;
+            depth = 0;
+        }
+        
+        // grow meshStart and meshEnd to hold the mesh
+        void addMeshBound(const AmTriangle &m);
+        
+        void freeEvents()
+        {
+            for (int axis = 0; axis < 3; axis++) {
+                vector<AmKDTreeEvent>().swap(startEvents[axis]);
+                vector<AmKDTreeEvent>().swap(endEvents[axis]);
+            }
+        }
+    };
+    typedef shared_ptr<AmKDTreeNode> AmKDTreeNodePtr;
+    
+    
+    /*
+     * compact kd-tree node used by the traversal, 8 bytes, nodes are
+     *  stored in depth-first order so the left child of an interior node
+     *  is the next node
+     *  interior: split value, the axis in the low 2 bits of flags and the
+     *            index of the right child in the other 30 bits
+     *  leaf:     offset of its meshes in the triangle buffer, the low 2
+     *            bits of flags are 3 and the other 30 bits the mesh count,
+     *            padded to a multiple of AM_SIMD_WIDTH
+     */
+    class AmKDTreeFlatNode
+    {
+    public:
+        union {
+            float           split;
+            unsigned int    offset;
+        };
+        unsigned int        flags;
+        
+        void initInterior(int axis, float value, unsigned int right)
+        {
+            split = value;
+            flags = static_cast<unsigned int>(axis) | (right << 2);
+        }
+        
+        void initLeaf(unsigned int first, unsigned int count)
+        {
+            offset = first;
+            flags = 3 | (count << 2);
+        }
+        
+        bool leaf() const
+        {
+            return (flags & 3) == 3;
+        }
+        
+        int axis() const
+        {
+            return flags & 3;
+        }
+        
+        unsigned int rightChild() const
+        {
+            return flags >> 2;
+        }
+        
+        unsigned int count() const
+        {
+            return flags >> 2;
+        }
+    };
+    
+    
+    /*
+     * kd-tree to accelerate the tracing
+     */
+    class AmKDTree : public AmAccelerator
+    {
+    public:
+        /* how to choose the split planes
+         *  AM_MEDIAN: cut off large blank space, or split the longest axis
+         *             at its spatial median, stop at depth 16 or 5 meshes
+         *  AM_SAH:    surface area heuristic, split where the estimated
+         *             traversal cost is the lowest, stop when no split is
+         *             cheaper than a leaf
+         */
+        enum AmHeuristic{AM_MEDIAN, AM_SAH};
+        
+        // cost of one traversal step and one ray-mesh test for the SAH
+        static const float SAH_TRAVERSAL;
+        static const float SAH_INTERSECT;
+        // cost reduction of a split that cuts off empty space
+        static const float SAH_EMPTY_BONUS;
+        // depth limit of any build, bounds the traversal stacks
+        static const int   MAX_DEPTH = 64;
+        // version of the cache file, bump it when the layout of the
+        //  file or the trees built change
+        static const unsigned int CACHE_VERSION = 1;
+        
+    private:
+        AmHeuristic heuristic;
+        int         maxDepth;   // depth limit of the current build
+        AmThreadPoolPtr pool;   // builds the subtrees if it is set
+        double      buildTime;  // seconds of the last init()
+        bool        cached;     // the last tree was loaded from the cache
+        
+    public:
+        // nodes during the build, freed when the tree is flattened
+        vector<AmKDTreeNodePtr>    nodes;
+        
+        // traversal representation, viewing cacheFile when it was loaded
+        AmArray<AmKDTreeFlatNode>  flatNodes;
+        AmTriangleBuffer           triangles;   // meshes of all the leaves
+        AmVec3f                    boxStart;    // bounding box of the root
+        AmVec3f                    boxEnd;
+        
+    private:
+        AmMappedFile               cacheFile;   // the last tree loaded
+        
+    public:
+        
+        AmKDTree()
+        :heuristic(AM_MEDIAN), maxDepth(16), buildTime(0), cached(false)
+        {}
+        
+        AmKDTree(AmHeuristic h)
+        :heuristic(h), maxDepth(16), buildTime(0), cached(false)
+        {}
+        
+        // takes effect on the next init()
+        void setHeuristic(AmHeuristic h)
+        {
+            heuristic = h;
+        }
+        
+        // build with the threads of the pool, takes effect on the next
+        //  init()
+        void setThreadPool(const AmThreadPoolPtr &p)
+        {
+            pool = p;
+        }
+        
+        void    init();               // build the kdtree from the model;
+        
+        // load the tree from the cache directory if the model and the
+        //  parameters didn't change, otherwise build it and save it there
+        void    initCached(const string &dir);
+        
+        // hash of the OBJ and MTL files and of the build parameters
+        unsigned long long cacheKey() const;
+        
+        // the traversal representation in a binary file, load returns
+        //  false if the file is missing, has another key or is broken
+        bool    save(const string &filename, unsigned long long key) const;
+        bool    load(const string &filename, unsigned long long key);
+        
+        // print node count and memory of the traversal representation
+        void    report(ostream &os) const;
+        float   search(const AmRay &ray, int &index) const;
+        
+        bool    occluded(const AmRay &ray, float tmax, int ignore) const;
+        
+        // trace the packet as a whole while the signs of the directions
+        //  agree, so the children are visited in the same order by all
+        //  the rays, otherwise ray by ray
+        void    searchPacket(const AmRayPacket &packet,
+                             float *hits, int *indices) const;
+        
+        // the kernels of the traversal, public for the microbenchmarks:
+        //  the interval of the ray in the root box, and the nearest hit
+        //  in a leaf of getFlatNodes()
+        bool hitBox(const AmRay &ray, float &tmin, float &tmax) const;
+        bool searchLeaf(const AmKDTreeFlatNode &node, const AmRay &ray,
+                        int &index, float &hit) const;
+        
+        const AmArray<AmKDTreeFlatNode> &getFlatNodes() const
+        {
+            return flatNodes;
+        }
+        
+    private:
+        // build the subtree of node index, its children are added to tree
+        void buildNode(vector<AmKDTreeNodePtr> &tree, int index);
+        void buildParallel();
+        void initEvents(const AmKDTreeNodePtr &root);
+        bool terminate(const AmKDTreeNodePtr &node);
+        void splitNode(vector<AmKDTreeNodePtr> &tree, int index);
+        void findPlane(const AmKDTreeNodePtr &node);
+        bool findPlaneSAH(const AmKDTreeNodePtr &node);
+        int  meshInNode(int mesh, const AmKDTreeNodePtr &node);
+        void flatten();
+        
+    };
+    
+    
+
+
+}
+
+
+#endif
@@ -30,7 +30,7 @@ int main(int argc, char * argv[])
     
     MyOpengl mygl(argc, argv, 100, 100);
     
-    AmModelPtr model(new AmModel(path));
+    AmModelPtr model(new AmModel(path, AmThreadPool::hardwareThreads()));
     model->utilize();
     mygl.setModel(model);
 	mygl.init();
@@ -0,0 +1,71 @@
+//
+//  mapfile.cpp
+//  raytracer
+//
+//  Created by ambling on 13-5-27.
+//  Copyright (c) 2013年 ambling. All rights reserved.
+//
+
+#include "mapfile.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+
+using namespace std;
+using namespace raytracer;
+
+
+bool AmMappedFile::open(const string &filename, bool copyOnWrite)
+{
+    close();
+    
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        ::close(fd);
+        return false;
+    }
+    
+    mSize = static_cast<size_t>(info.st_size);
+    if (mSize > 0) {
+        int protection = copyOnWrite ? (PROT_READ | PROT_WRITE) : PROT_READ;
+        mData = mmap(0, mSize, protection, MAP_PRIVATE, fd, 0);
+        if (mData == MAP_FAILED) {
+            mData = 0;
+            mSize = 0;
+            ::close(fd);
+            return false;
+        }
+    }
+    // the mapping stays valid after the descriptor is closed
+    ::close(fd);
+    return true;
+}
+
+void AmMappedFile::close()
+{
+    if (mData) {
+        munmap(mData, mSize);
+    }
+    mData = 0;
+    mSize = 0;
+}
+
+void AmMappedFile::release(const char *first, const char *last)
+{
+    // only the whole pages inside the range
+    uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    uintptr_t begin = (reinterpret_cast<uintptr_t>(first) + page - 1)
+                        / page * page;
+    uintptr_t end = reinterpret_cast<uintptr_t>(last) / page * page;
+    if (mData && begin < end) {
+        madvise(reinterpret_cast<void *>(begin), end - begin, MADV_DONTNEED);
+    }
+}
@@ -0,0 +1,68 @@
+//
+//  mapfile.h
+//  raytracer
+//
+//  read-only memory mapping of a whole file
+//
+//  Created by ambling on 13-5-27.
+//  Copyright (c) 2013年 ambling. All rights reserved.
+//
+
+#ifndef raytracer_mapfile_h
+#define raytracer_mapfile_h
+
+#include "utils.h"
+
+using namespace std;
+
+namespace raytracer {
+    
+    class AmMappedFile
+    {
+        void    *mData;
+        size_t  mSize;
+        
+        // not copyable, it owns the mapping
+        AmMappedFile(const AmMappedFile &);
+        AmMappedFile &operator = (const AmMappedFile &);
+        
+    public:
+        AmMappedFile()
+            :mData(0), mSize(0)
+        {}
+        
+        ~AmMappedFile()
+        {
+            close();
+        }
+        
+        // map the file, return false if it can't be opened or mapped;
+        //  an empty file is opened with no data. With copyOnWrite the
+        //  pages may be written, the changes are private to the process
+        bool open(const string &filename, bool copyOnWrite = false);
+        void close();
+        
+        // drop the pages of [first, last) from memory, they are read
+        //  from the file again when they are touched
+        void release(const char *first, const char *last);
+        
+        const char *data() const
+        {
+            return static_cast<const char *>(mData);
+        }
+        
+        // only writable when opened with copyOnWrite
+        char *data()
+        {
+            return static_cast<char *>(mData);
+        }
+        
+        size_t size() const
+        {
+            return mSize;
+        }
+    };
+    
+}
+
+#endif
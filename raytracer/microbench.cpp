@@ -0,0 +1,315 @@
+//
+//  microbench.cpp
+//  raytracer
+//
+//  microbenchmarks of the kernels of the raytracer: every kernel runs
+//  over a fixed table of inputs drawn from a seeded generator, so two
+//  runs with the same seed and model time the same work. Prints the
+//  median ns per call and calls per second of each kernel
+//
+//  Created by ambling on 13-6-4.
+//  Copyright (c) 2013年 ambling. All rights reserved.
+//
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include "utils.h"
+#include "model.h"
+#include "raytracer.h"
+
+using namespace raytracer;
+
+/*
+ * xorshift64* generator, the same sequence on every platform, unlike
+ *  the distributions of <random>
+ */
+class AmRandom
+{
+    unsigned long long state;
+
+public:
+    AmRandom(unsigned long long seed)
+        :state(seed ? seed : 1)
+    {}
+
+    unsigned long long next()
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 2685821657736338717ULL;
+    }
+
+    // uniform in [lo, hi)
+    float uniform(float lo, float hi)
+    {
+        return lo + (hi - lo) * ((next() >> 40) * (1.0f / 16777216.0f));
+    }
+
+    AmVec3f point(float lo, float hi)
+    {
+        float x = uniform(lo, hi);
+        float y = uniform(lo, hi);
+        return AmVec3f(x, y, uniform(lo, hi));
+    }
+
+    AmVec3f direction()
+    {
+        AmVec3f d;
+        do {
+            d = point(-1, 1);
+        } while (d.dot(d) > 1 || d.dot(d) < 1e-4f);
+        d.normalize();
+        return d;
+    }
+};
+
+// the inputs of every kernel, a power of two so i & MASK walks them
+static const int INPUTS = 4096;
+static const int MASK = INPUTS - 1;
+
+// a kernel runs calls times and returns the sum of its results, which
+//  is kept so the calls aren't optimized out
+typedef function<float(long)> AmKernel;
+
+/*
+ * times the kernels and prints a line for each
+ */
+class AmMicroBench
+{
+    double  minTime;    // seconds of a repetition at least
+    int     repeats;    // repetitions, the median is reported
+
+public:
+    double  checksum;   // of one pass over the inputs, the same every run
+    double  sink;       // of the timed calls
+
+    AmMicroBench(double t, int r)
+        :minTime(t), repeats(r), checksum(0), sink(0)
+    {}
+
+    void run(const string &name, const AmKernel &kernel)
+    {
+        checksum += kernel(INPUTS);
+
+        // find the number of calls that takes minTime
+        long calls = 1024;
+        while (1) {
+            AmTimer timer;
+            sink += kernel(calls);
+            if (timer.elapsed() >= minTime || calls >= (1L << 30)) {
+                break;
+            }
+            calls *= 2;
+        }
+
+        vector<double> ns;
+        for (int r = 0; r < repeats; r++) {
+            AmTimer timer;
+            sink += kernel(calls);
+            ns.push_back(timer.elapsed() * 1e9 / calls);
+        }
+        sort(ns.begin(), ns.end());
+        double median = ns[ns.size() / 2];
+        printf("%-24s %10.2f ns/call %10.2f Mcalls/s  (min %.2f, max %.2f)\n",
+               name.c_str(), median, 1e3 / median, ns.front(), ns.back());
+    }
+};
+
+static void usage(const char *name)
+{
+    cerr<<"usage: "<<name<<" [options]"<<endl
+        <<"  -model file      model of the kd-tree kernels"<<endl
+        <<"                   (default obj/table12/table12.obj)"<<endl
+        <<"  -seed n          seed of the inputs (default 1)"<<endl
+        <<"  -time t          seconds of a repetition at least"<<endl
+        <<"                   (default 0.05)"<<endl
+        <<"  -repeats n       repetitions, the median is printed"<<endl
+        <<"                   (default 7)"<<endl;
+}
+
+int main(int argc, char * argv[])
+{
+    string path("obj/table12/table12.obj");
+    unsigned long long seed = 1;
+    double minTime = 0.05;
+    int repeats = 7;
+
+    for (int i = 1; i < argc; i++) {
+        string arg(argv[i]);
+        bool more = (i + 1 < argc);
+        bool ok = true;
+
+        if (arg == "-model" && more) {
+            path = argv[++i];
+        } else if (arg == "-seed" && more) {
+            seed = strtoull(argv[++i], 0, 10);
+        } else if (arg == "-time" && more) {
+            minTime = atof(argv[++i]);
+            ok = (minTime > 0);
+        } else if (arg == "-repeats" && more) {
+            repeats = atoi(argv[++i]);
+            ok = (repeats > 0);
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            cerr<<"bad argument: "<<arg<<endl;
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    AmModelPtr model(new AmModel(path));
+    if (model->mTriangles.size() == 0) {
+        cerr<<"no triangles in model: "<<path<<endl;
+        return 1;
+    }
+    model->utilize();
+    AmKDTree tree;
+    tree.setModel(model);
+    tree.init();
+
+    // the inputs, drawn in a fixed order so a kernel added later doesn't
+    //  change the inputs of the others
+    AmRandom random(seed);
+    vector<AmRay> rays;
+    vector<AmVec3f> a, b, c, normals, dirs;
+    for (int i = 0; i < INPUTS; i++) {
+        // from outside the unit cube through a point inside it
+        AmVec3f orig = random.direction() * 2;
+        AmVec3f dir = random.point(-0.5f, 0.5f) - orig;
+        dir.normalize();
+        rays.push_back(AmRay(orig, dir));
+        // triangles about the origin, a part of them hit by the rays
+        a.push_back(random.point(-0.5f, 0.5f));
+        b.push_back(random.point(-0.5f, 0.5f));
+        c.push_back(random.point(-0.5f, 0.5f));
+        normals.push_back(random.direction());
+        dirs.push_back(random.direction());
+    }
+    vector<const AmKDTreeFlatNode *> leaves;
+    const AmArray<AmKDTreeFlatNode> &nodes = tree.getFlatNodes();
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].leaf() && nodes[i].count() > 0) {
+            leaves.push_back(&nodes[i]);
+        }
+    }
+    vector<const AmKDTreeFlatNode *> leafInputs;
+    double leafSize = 0;
+    for (int i = 0; i < INPUTS; i++) {
+        leafInputs.push_back(leaves[random.next() % leaves.size()]);
+        leafSize += leafInputs.back()->count();
+    }
+    AmMaterial glass;
+    glass.density = 1.5;
+
+    printf("model %s: %lu triangles, %lu leaves, %.1f triangles per leaf"
+           " in the inputs\n", path.c_str(),
+           static_cast<unsigned long>(model->mTriangles.size()),
+           static_cast<unsigned long>(leaves.size()), leafSize / INPUTS);
+    printf("seed %llu, %d inputs per kernel, %d repetitions of %g s\n",
+           seed, INPUTS, repeats, minTime);
+
+    AmMicroBench bench(minTime, repeats);
+    bench.run("hitMesh", [&](long calls) {
+        float sum = 0;
+        for (long i = 0; i < calls; i++) {
+            int k = i & MASK;
+            sum += AmRayTracer::hitMesh(rays[k], a[k], b[k], c[k]);
+        }
+        return sum;
+    });
+    bench.run("AmKDTree::hitBox", [&](long calls) {
+        float sum = 0;
+        for (long i = 0; i < calls; i++) {
+            float tmin, tmax;
+            if (tree.hitBox(rays[i & MASK], tmin, tmax)) {
+                sum += tmin;
+            }
+        }
+        return sum;
+    });
+    bench.run("AmKDTree::searchLeaf", [&](long calls) {
+        float sum = 0;
+        for (long i = 0; i < calls; i++) {
+            int k = i & MASK;
+            int index;
+            float hit;
+            if (tree.searchLeaf(*leafInputs[k], rays[k], index, hit)) {
+                sum += hit;
+            }
+        }
+        return sum;
+    });
+    bench.run("AmKDTree::search", [&](long calls) {
+        float sum = 0;
+        for (long i = 0; i < calls; i++) {
+            int index;
+            sum += tree.search(rays[i & MASK], index);
+        }
+        return sum;
+    });
+    bench.run("getReflRayDir", [&](long calls) {
+        float sum = 0;
+        for (long i = 0; i < calls; i++) {
+            int k = i & MASK;
+            sum += AmRayTracer::getReflRayDir(dirs[k], normals[k]).x();
+        }
+        return sum;
+    });
+    bench.run("getRefrRayDir", [&](long calls) {
+        float sum = 0;
+        for (long i = 0; i < calls; i++) {
+            int k = i & MASK;
+            sum += AmRayTracer::getRefrRayDir(dirs[k], normals[k], &glass).x();
+        }
+        return sum;
+    });
+    bench.run("AmVec3f dot", [&](long calls) {
+        float sum = 0;
+        for (long i = 0; i < calls; i++) {
+            int k = i & MASK;
+            sum += a[k].dot(b[k]);
+        }
+        return sum;
+    });
+    bench.run("AmVec3f cross", [&](long calls) {
+        float sum = 0;
+        for (long i = 0; i < calls; i++) {
+            int k = i & MASK;
+            sum += a[k].cross(b[k]).y();
+        }
+        return sum;
+    });
+    bench.run("AmVec3f a + b * s", [&](long calls) {
+        float sum = 0;
+        for (long i = 0; i < calls; i++) {
+            int k = i & MASK;
+            sum += (a[k] + b[k] * c[k].x()).z();
+        }
+        return sum;
+    });
+    bench.run("AmVec3f normalize", [&](long calls) {
+        float sum = 0;
+        for (long i = 0; i < calls; i++) {
+            AmVec3f v(a[i & MASK]);
+            v.normalize();
+            sum += v.x();
+        }
+        return sum;
+    });
+    bench.run("AmVec3f det", [&](long calls) {
+        float sum = 0;
+        for (long i = 0; i < calls; i++) {
+            int k = i & MASK;
+            sum += a[k].det(b[k], c[k]);
+        }
+        return sum;
+    });
+
+    printf("checksum %.9g (%g)\n", bench.checksum, bench.sink);
+    return 0;
+}
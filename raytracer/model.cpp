@@ -14,6 +14,8 @@
 #include "model.h"
 
 #include <sstream>
+#include <cstring>
+#include <cstdlib>
 
 using namespace std;
 using namespace raytracer;
@@ -25,29 +27,394 @@ using namespace raytracer;
  *
  */
 
-AmModel::AmModel(string filename)
-    :mPathname(filename)
+AmModel::AmModel(string filename, int threads)
+    :AmModel(filename, AmLoadOptions(threads))
 {
-    readOBJ(filename);
 }
 
-// read wavefront obj file
-void AmModel::readOBJ(string filename)
+AmModel::AmModel(string filename, const AmLoadOptions &options)
+    :mPathname(filename), mUtilized(false),
+    mCountTime(0), mCommandTime(0), mParseTime(0), mCommands(0),
+    mWeldVertices(0), mWeldTriangles(0), mWeldBytes(0), mWeldTime(-1),
+    mEditHash(0)
 {
-    /* open the file */
-    ifstream ifs(filename);
-    assert(ifs);
+    if (!isScene(filename)) {
+        readOBJ(filename, options);
+    } else if (!readScene(filename)) {
+        cerr<<"bad scene file: "<<filename<<endl;
+    }
+}
+
+// read wavefront obj file, return false if it can't be read within
+//  the memory limit
+bool AmModel::readOBJ(string filename, const AmLoadOptions &options)
+{
+    /* map the file */
+    AmMappedFile file;
+    bool opened = file.open(filename);
+    assert(opened);
+    if (!opened) {
+        cerr<<"can't open model: "<<filename<<endl;
+        return false;
+    }
     
     // make a pass through the file to read in the data
-    pass(ifs);
+    return pass(file, options);
+}
+
+
+////// scanners of the obj text, they never read past end //////
+
+static const double POW10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// spaces and tabs, not the end of the line
+static inline void skipSpaces(const char *&p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        p++;
+    }
+}
+
+// to the start of the next line
+static inline void skipLine(const char *&p, const char *end)
+{
+    const void *eol = memchr(p, '\n', end - p);
+    p = eol ? static_cast<const char *>(eol) + 1 : end;
+}
+
+static inline bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// the next word of the line, empty at the end of the line
+static inline string scanWord(const char *&p, const char *end)
+{
+    skipSpaces(p, end);
+    const char *first = p;
+    while (p < end && !isSpace(*p)) {
+        p++;
+    }
+    return string(first, p);
+}
+
+static inline bool scanInt(const char *&p, const char *end, int &value)
+{
+    bool negative = (p < end && *p == '-');
+    if (p < end && (*p == '-' || *p == '+')) {
+        p++;
+    }
+    if (p >= end || !isDigit(*p)) {
+        return false;
+    }
+    int v = 0;
+    while (p < end && isDigit(*p)) {
+        v = v * 10 + (*p - '0');
+        p++;
+    }
+    value = negative ? -v : v;
+    return true;
+}
+
+// strtof on the word [first, last), the mapped text has no terminating 0
+static float strtofWord(const char *first, const char *last,
+                        bool *valid = 0)
+{
+    char buf[64];
+    size_t n = min(static_cast<size_t>(last - first), sizeof(buf) - 1);
+    memcpy(buf, first, n);
+    buf[n] = 0;
+    char *stop;
+    float f = strtof(buf, &stop);
+    if (valid) {
+        *valid = (stop != buf);
+    }
+    return f;
+}
+
+// decimal numbers with up to 19 digits are built from their integer
+//  digits and one multiplication or division by an exact power of ten,
+//  which rounds correctly while both are exact. Anything else is left
+//  to strtof
+static inline bool scanFloat(const char *&p, const char *end, float &value)
+{
+    skipSpaces(p, end);
+    const char *first = p;
+    bool negative = (p < end && *p == '-');
+    if (p < end && (*p == '-' || *p == '+')) {
+        p++;
+    }
+    
+    unsigned long long mantissa = 0;
+    int digits = 0, exponent = 0;   // significant digits in the mantissa
+    bool any = false, exact = true;
+    while (p < end && isDigit(*p)) {
+        if (digits > 0 || *p != '0') {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits++;
+            } else {
+                exponent++;
+                exact = exact && *p == '0';
+            }
+        }
+        p++;
+        any = true;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && isDigit(*p)) {
+            if (digits > 0 || *p != '0') {
+                if (digits < 19) {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    digits++;
+                    exponent--;
+                } else {
+                    exact = exact && *p == '0';
+                }
+            } else {
+                exponent--;
+            }
+            p++;
+            any = true;
+        }
+    }
+    if (any && p < end && (*p == 'e' || *p == 'E')) {
+        const char *mark = p++;
+        int e;
+        if (scanInt(p, end, e)) {
+            exponent += e;
+        } else {
+            p = mark;
+        }
+    }
+    
+    if (!any || (p < end && !isSpace(*p) && *p != '#')) {
+        // not a plain decimal number (inf, nan, hex...)
+        p = first;
+        while (p < end && !isSpace(*p)) {
+            p++;
+        }
+        bool valid;
+        float f = strtofWord(first, p, &valid);
+        if (valid) {
+            value = f;
+        }
+        return valid;
+    }
+    
+    float f;
+    if (mantissa == 0) {
+        f = 0;
+    } else if (!exact) {
+        f = fabsf(strtofWord(first, p));
+    } else if (mantissa <= (1ULL << 24) && exponent >= -10 && exponent <= 10) {
+        // exact in float
+        f = exponent < 0 ? mantissa / static_cast<float>(POW10[-exponent])
+                         : mantissa * static_cast<float>(POW10[exponent]);
+    } else if (mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+        // exact in double; rounding it again to float is only wrong when
+        //  the double falls exactly between two floats
+        f = static_cast<float>(exponent < 0 ? mantissa / POW10[-exponent]
+                                            : mantissa * POW10[exponent]);
+    } else {
+        f = fabsf(strtofWord(first, p));
+    }
+    value = negative ? -f : f;
+    return true;
+}
+
+// obj indices start from 1 in each file and count back from the end
+//  when negative, 0 when they are not given
+static inline unsigned int objIndex(int index, unsigned int base, size_t size)
+{
+    if (index > 0) {
+        return index + base;
+    } else if (index < 0) {
+        return static_cast<unsigned int>(size + index);
+    }
+    return 0;
+}
+
+// one vertex of a face, one of %d, %d//%d, %d/%d, %d/%d/%d
+static inline bool scanFaceVertex(const char *&p, const char *end,
+                                  int &v, int &t, int &n)
+{
+    skipSpaces(p, end);
+    t = n = 0;
+    if (!scanInt(p, end, v)) {
+        return false;
+    }
+    if (p < end && *p == '/') {
+        p++;
+        scanInt(p, end, t);
+        if (p < end && *p == '/') {
+            p++;
+            scanInt(p, end, n);
+        }
+    }
+    return true;
+}
+
+namespace raytracer {
+    
+    // a g, usemtl or mtllib line, which changes the state of the parser
+    class AmObjCommand
+    {
+    public:
+        size_t          triangle;   // triangles of the chunk before it
+        char            type;       // 'g', 'u' or 'm'
+        string          name;
+        unsigned int    group;      // the current group after it
+    };
+    
+    /*
+     * a piece of the obj text which starts at a line, the first pass
+     *  counts its elements and collects its commands, the second one
+     *  writes its elements from the given offsets of the model arrays
+     */
+    class AmObjChunk
+    {
+    public:
+        enum { VERTICES, NORMALS, TEXCOORDS, TRIANGLES, KINDS };
+        
+        const char      *begin, *end;
+        size_t          count[KINDS];
+        size_t          first[KINDS];   // offsets in the model arrays
+        unsigned int    group;          // the current group at the start
+        vector<AmObjCommand> commands;
+        
+        AmObjChunk(const char *b, const char *e)
+            :begin(b), end(e), count{0, 0, 0, 0}, first{0, 0, 0, 0},
+            group(0)
+        {}
+    };
+    
+    // a run of triangles of the same group
+    class AmObjRange
+    {
+    public:
+        size_t          first, count;
+        unsigned int    group;
+    };
+    
+}
+
+// first pass of a chunk
+static void countChunk(AmObjChunk &chunk, const AmLoadOptions &options)
+{
+    const char *p = chunk.begin, *end = chunk.end;
+    while (p < end) {
+        skipSpaces(p, end);
+        if (p >= end) {
+            break;
+        }
+        switch (*p) {
+            case 'v':
+                p++;
+                if (p < end && (*p == ' ' || *p == '\t')) {
+                    chunk.count[AmObjChunk::VERTICES]++;
+                } else if (p < end && *p == 'n' && options.normals) {
+                    chunk.count[AmObjChunk::NORMALS]++;
+                } else if (p < end && *p == 't' && options.texcoords) {
+                    chunk.count[AmObjChunk::TEXCOORDS]++;
+                }
+                break;
+            case 'm':
+            case 'u':
+            case 'g':
+            {
+                AmObjCommand command;
+                command.triangle = chunk.count[AmObjChunk::TRIANGLES];
+                command.type = *p;
+                command.group = 0;
+                scanWord(p, end);
+                command.name = scanWord(p, end);
+                chunk.commands.push_back(command);
+                break;
+            }
+            case 'f':
+            {
+                p++;
+                int v, t, n;
+                size_t count = 0;
+                while (scanFaceVertex(p, end, v, t, n)) {
+                    count++;
+                }
+                if (count >= 3) {
+                    chunk.count[AmObjChunk::TRIANGLES] += count - 2;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        skipLine(p, end);
+    }
+}
+
+// run work on every chunk, a window of at most window bytes of the
+//  text at a time, and drop the pages of the window when it is done
+static void runChunks(vector<AmObjChunk> &chunks,
+                      const function<void(AmObjChunk &)> &work,
+                      size_t window, AmMappedFile &file, AmThreadPool *pool)
+{
+    size_t first = 0;
+    while (first < chunks.size()) {
+        vector<AmThreadPool::AmTask> tasks;
+        size_t last = first, bytes = 0;
+        while (last < chunks.size()) {
+            size_t chunkBytes = chunks[last].end - chunks[last].begin;
+            if (last > first && bytes + chunkBytes > window) {
+                break;
+            }
+            AmObjChunk *chunk = &chunks[last];
+            tasks.push_back([=, &work](int) { work(*chunk); });
+            bytes += chunkBytes;
+            last++;
+        }
+        
+        if (pool && tasks.size() > 1) {
+            pool->run(tasks);
+        } else {
+            for (size_t i = 0; i < tasks.size(); i++) {
+                tasks[i](0);
+            }
+        }
+        if (window < file.size()) {
+            file.release(chunks[first].begin, chunks[last - 1].end);
+        }
+        first = last;
+    }
 }
 
 /* pass: pass through the Wavefront OBJ file that gets all
  * the data.
  *
- * ifs-- ifstream of the OBJ file
+ * file -- the mapped OBJ file
+ * options -- threads, arrays to keep and the memory limit
+ *
+ * The text is cut into chunks at line ends. The chunks are counted in
+ *  parallel, then the g/usemtl/mtllib commands are replayed in order,
+ *  which gives the groups and the materials the same indices as a
+ *  sequential parse, and a prefix sum of the counts gives every chunk
+ *  its place in the arrays. The chunks are parsed in parallel straight
+ *  into the arrays, which are allocated once with their final sizes.
+ *
+ * With a memory limit, a quarter of it is the window of the text which
+ *  is parsed at a time, the pages of the text are dropped behind it.
+ *  The model must fit in the rest, which is known after the counting,
+ *  before anything is allocated. Return false if it doesn't fit.
  */
-void AmModel::pass(ifstream &ifs)
+bool AmModel::pass(AmMappedFile &file, const AmLoadOptions &options)
 {
     unsigned int numvertices;        /* number of vertices in model */
     unsigned int numnormals;         /* number of normals in model */
@@ -83,240 +450,239 @@ void AmModel::pass(ifstream &ifs)
     material = group = 0;
     // index from 1
     if (mMaterials.size() == 0) {
-        mMaterials.push_back(AmMaterial());//first one of blank material
+        addMaterial(AmMaterial());//first one of blank material
     }
     
-    // pass through the file, read all the data
-    while(!ifs.eof()) {
-        char buf[128];
-        ifs.getline(buf, 128);
-        istringstream sreader(buf);
-        
-        string first, remain;
-        AmVec3f vec3f(0, 0, 0);
-        AmVec2f vec2f(0, 0);
-        
-        switch(buf[0]) {
-            case '#':               /* comment */
+    // cut the text at the first line end after every CHUNK_SIZE bytes,
+    //  a small file is one chunk
+    int threads = max(options.threads, 1);
+    const char *p = file.data(), *end = file.data() + file.size();
+    size_t size = file.size();
+    size_t window = size;
+    if (options.memoryLimit > 0) {
+        window = min(max(options.memoryLimit / 4, CHUNK_SIZE), size);
+    }
+    size_t chunkSize = max(min(size, window) / (threads * 4) + 1, CHUNK_SIZE);
+    vector<AmObjChunk> chunks;
+    while (p < end) {
+        const char *last = p + min(chunkSize, static_cast<size_t>(end - p));
+        skipLine(last, end);
+        chunks.push_back(AmObjChunk(p, last));
+        p = last;
+    }
+    AmThreadPoolPtr pool;
+    if (threads > 1 && chunks.size() > 1) {
+        pool = AmThreadPoolPtr(new AmThreadPool(threads));
+    }
+    
+    AmTimer timer;
+    runChunks(chunks, [&](AmObjChunk &chunk) { countChunk(chunk, options); },
+              window, file, pool.get());
+    mCountTime = timer.elapsed();
+    
+    // place the chunks
+    size_t next[AmObjChunk::KINDS] = {mVertices.size(), mNormals.size(),
+                                     mTexcoords.size(), numtriangles};
+    for (size_t i = 0; i < chunks.size(); i++) {
+        for (int k = 0; k < AmObjChunk::KINDS; k++) {
+            chunks[i].first[k] = next[k];
+            next[k] += chunks[i].count[k];
+        }
+    }
+    
+    // the arrays, with the normals of the triangles and the lists of
+    //  the groups
+    size_t bytes = next[AmObjChunk::VERTICES] * sizeof(AmVec3f)
+                    + next[AmObjChunk::NORMALS] * sizeof(AmVec3f)
+                    + next[AmObjChunk::TEXCOORDS] * sizeof(AmVec2f)
+                    + next[AmObjChunk::TRIANGLES] * (sizeof(AmTriangle)
+                                + sizeof(AmVec3f) + sizeof(unsigned int));
+    if (options.memoryLimit > 0 && bytes + window > options.memoryLimit) {
+        cerr<<"the model needs "<<bytes + window<<" bytes ("<<bytes
+            <<" for the arrays, "<<window<<" for the mapped text), over the "
+            <<"memory limit of "<<options.memoryLimit<<" bytes"<<endl;
+        return false;
+    }
+    
+    // replay the commands
+    timer.reset();
+    mCommands = 0;
+    vector<AmObjRange> ranges;
+    for (size_t i = 0; i < chunks.size(); i++) {
+        AmObjChunk &chunk = chunks[i];
+        chunk.group = group;
+        size_t done = 0;
+        for (size_t c = 0; c <= chunk.commands.size(); c++) {
+            size_t triangle = (c < chunk.commands.size()) ?
+                                chunk.commands[c].triangle :
+                                chunk.count[AmObjChunk::TRIANGLES];
+            if (triangle > done) {
+                if (mGroups.empty()) {
+                    // faces before any group
+                    group = findGroup("default");
+                    mGroups[group].material = material;
+                }
+                AmObjRange range = {chunk.first[AmObjChunk::TRIANGLES] + done,
+                                    triangle - done, group};
+                ranges.push_back(range);
+                done = triangle;
+            }
+            if (c == chunk.commands.size()) {
                 break;
+            }
+            
+            AmObjCommand &command = chunk.commands[c];
+            mCommands++;
+            switch (command.type) {
+                case 'm':
+                    mMtllibname = command.name;
+                    readMTL();
+                    break;
+                case 'u':
+                    if (mGroups.empty()) {
+                        group = findGroup("default");
+                    }
+                    mGroups[group].material = material = findMaterial(command.name);
+                    break;
+                case 'g':
+                    group = findGroup(command.name);
+                    mGroups[group].material = material;
+                    break;
+            }
+            command.group = group;
+        }
+    }
+    
+    // the triangle lists of the groups, in the order of the file
+    vector<size_t> groupSizes(mGroups.size(), 0);
+    for (size_t i = 0; i < ranges.size(); i++) {
+        groupSizes[ranges[i].group] += ranges[i].count;
+    }
+    for (size_t g = 0; g < mGroups.size(); g++) {
+        mGroups[g].triangles.reserve(mGroups[g].triangles.size()
+                                     + groupSizes[g]);
+    }
+    for (size_t i = 0; i < ranges.size(); i++) {
+        AmArray<unsigned int> &list = mGroups[ranges[i].group].triangles;
+        for (size_t t = 0; t < ranges[i].count; t++) {
+            list.push_back(static_cast<unsigned int>(ranges[i].first + t));
+        }
+    }
+    
+    mCommandTime = timer.elapsed();
+    
+    timer.reset();
+    mVertices.resize(next[AmObjChunk::VERTICES]);
+    mNormals.resize(next[AmObjChunk::NORMALS]);
+    mTexcoords.resize(next[AmObjChunk::TEXCOORDS]);
+    mTriangles.resize(next[AmObjChunk::TRIANGLES], AmTriangle(0));
+    
+    unsigned int base[3] = {numvertices, numnormals, numtexcoords};
+    runChunks(chunks, [&](AmObjChunk &chunk) {
+                            parseChunk(chunk, base, options);
+                        }, window, file, pool.get());
+    mParseTime = timer.elapsed();
+    return true;
+}
+
+/* parseChunk: second pass of a chunk, every line writes at the next
+ *  offset of the chunk
+ *
+ * base -- base indices of the vertices, normals and texcoords
+ */
+void AmModel::parseChunk(const AmObjChunk &chunk, const unsigned int base[3],
+                         const AmLoadOptions &options)
+{
+    size_t nextVertex = chunk.first[AmObjChunk::VERTICES];
+    size_t nextNormal = chunk.first[AmObjChunk::NORMALS];
+    size_t nextTexcoord = chunk.first[AmObjChunk::TEXCOORDS];
+    size_t nextTriangle = chunk.first[AmObjChunk::TRIANGLES];
+    size_t command = 0;
+    unsigned int group = chunk.group;
+    
+    const char *p = chunk.begin, *end = chunk.end;
+    while (p < end) {
+        skipSpaces(p, end);
+        if (p >= end) {
+            break;
+        }
+        
+        switch(*p) {
             case 'v':               /* v, vn, vt */
-                sreader>>first;
-                if(first == "v")
+                p++;
+                if (p < end && (*p == ' ' || *p == '\t'))
                 {/* vertex */
-                    sreader>>vec3f.mData[0]
-                            >>vec3f.mData[1]
-                            >>vec3f.mData[2];
-                    mVertices.push_back(vec3f);
-                } else if(first == "vn") {
+                    AmVec3f &vec3f = mVertices[nextVertex++];
+                    scanFloat(p, end, vec3f.mData[0]);
+                    scanFloat(p, end, vec3f.mData[1]);
+                    scanFloat(p, end, vec3f.mData[2]);
+                } else if (p < end && *p == 'n' && options.normals) {
                     /* normal */
-                    sreader>>vec3f.mData[0]
-                            >>vec3f.mData[1]
-                            >>vec3f.mData[2];
-                    mNormals.push_back(vec3f);
-                } else if(first == "vt"){
+                    p++;
+                    AmVec3f &vec3f = mNormals[nextNormal++];
+                    scanFloat(p, end, vec3f.mData[0]);
+                    scanFloat(p, end, vec3f.mData[1]);
+                    scanFloat(p, end, vec3f.mData[2]);
+                } else if (p < end && *p == 't' && options.texcoords) {
                     /* texcoord */
-                    sreader>>vec2f.mData[0]
-                            >>vec2f.mData[1];
-                    mTexcoords.push_back(vec2f);
+                    p++;
+                    AmVec2f &vec2f = mTexcoords[nextTexcoord++];
+                    scanFloat(p, end, vec2f.mData[0]);
+                    scanFloat(p, end, vec2f.mData[1]);
                 }
                 break;
-            case 'm':
-                sreader>>first>>mMtllibname;
-                readMTL();
-                break;
-            case 'u':
-                sreader>>first>>remain;
-                mGroups[group].material = material = findMaterial(remain);
-                break;
-            case 'g':               /* group */
-                sreader>>first>>remain;
-                group = findGroup(remain);
-                mGroups[group].material = material;
+            case 'm':               /* mtllib, usemtl and group, */
+            case 'u':               /*  replayed already */
+            case 'g':
+                group = chunk.commands[command++].group;
                 break;
             case 'f':               /* face */
             {
-                int v, n, t;
-                v = n = t = 0;
+                p++;
+                /* the polygon is split into a fan of triangles */
                 AmTriangle triangle(group);
-                sreader>>first>>remain;
-                /* can be one of %d, %d//%d, %d/%d, %d/%d/%d */
-                if (sscanf(remain.c_str(), "%d//%d", &v, &n) == 2) {
-                    /* v//n */
-                    assert(v>0);assert(n>0);//do not accept negative indices
-                    triangle.vindices[0] = v+numvertices;
-                    triangle.nindices[0] = n+numnormals;
-                    
-                    sreader>>remain;
-                    sscanf(remain.c_str(), "%d//%d", &v, &n);
-                    assert(v>0);assert(n>0);//do not accept negative indices
-                    triangle.vindices[1] = v+numvertices;
-                    triangle.nindices[1] = n+numnormals;
-                    
-                    sreader>>remain;
-                    sscanf(remain.c_str(), "%d//%d", &v, &n);
-                    assert(v>0);assert(n>0);//do not accept negative indices
-                    triangle.vindices[2] = v+numvertices;
-                    triangle.nindices[2] = n+numnormals;
-                    
-                    mTriangles.push_back(triangle);
-                    mGroups[group].triangles.push_back(numtriangles);
-                    numtriangles++;
-                    assert(mTriangles.size() == numtriangles);//check count
-                    while(sreader>>remain) {
-                        AmTriangle nextTri(group);
-                        sscanf(remain.c_str(), "%d//%d", &v, &n);
-                        assert(v>0);assert(n>0);//do not accept negative indices
-                        nextTri.vindices[0] = triangle.vindices[0];
-                        nextTri.nindices[0] = triangle.nindices[0];
-                        nextTri.vindices[1] = triangle.vindices[2];
-                        nextTri.nindices[1] = triangle.nindices[2];
-                        nextTri.vindices[2] = v+numvertices;
-                        nextTri.nindices[2] = n+numnormals;
-                        
-                        mTriangles.push_back(nextTri);
-                        mGroups[group].triangles.push_back(numtriangles);
-                        numtriangles++;
-                        assert(mTriangles.size() == numtriangles);//check count
+                int count = 0, v, t, n;
+                while (scanFaceVertex(p, end, v, t, n)) {
+                    int slot = min(count, 2);
+                    triangle.vindices[slot] = objIndex(v, base[0], nextVertex);
+                    if (options.normals) {
+                        triangle.nindices[slot] = objIndex(n, base[1],
+                                                           nextNormal);
                     }
-                } else if(sscanf(remain.c_str(), "%d/%d/%d", &v, &t, &n) == 3) {
-                    /* v/t/n */
-                    //do not accept negative indices
-                    assert(v>0);assert(t>0);assert(n>0);
-                    triangle.vindices[0] = v+numvertices;
-                    triangle.tindices[0] = t+numtexcoords;
-                    triangle.nindices[0] = n+numnormals;
-                    
-                    sreader>>remain;
-                    sscanf(remain.c_str(), "%d/%d/%d", &v, &t, &n);
-                    //do not accept negative indices
-                    assert(v>0);assert(t>0);assert(n>0);
-                    triangle.vindices[1] = v+numvertices;
-                    triangle.tindices[1] = t+numtexcoords;
-                    triangle.nindices[1] = n+numnormals;
-                    
-                    sreader>>remain;
-                    sscanf(remain.c_str(), "%d/%d/%d", &v, &t, &n);
-                    //do not accept negative indices
-                    assert(v>0);assert(t>0);assert(n>0);
-                    triangle.vindices[2] = v+numvertices;
-                    triangle.tindices[2] = t+numtexcoords;
-                    triangle.nindices[2] = n+numnormals;
-                    
-                    mTriangles.push_back(triangle);
-                    mGroups[group].triangles.push_back(numtriangles);
-                    numtriangles++;
-                    assert(mTriangles.size() == numtriangles);//check count
-                    while(sreader>>remain) {
-                        AmTriangle nextTri(group);
-                        sscanf(remain.c_str(), "%d/%d/%d", &v, &t, &n);
-                        //do not accept negative indices
-                        assert(v>0);assert(t>0);assert(n>0);
-                        
-                        nextTri.vindices[0] = triangle.vindices[0];
-                        nextTri.tindices[0] = triangle.tindices[0];
-                        nextTri.nindices[0] = triangle.nindices[0];
-                        nextTri.vindices[1] = triangle.vindices[2];
-                        nextTri.tindices[1] = triangle.tindices[2];
-                        nextTri.nindices[1] = triangle.nindices[2];
-                        nextTri.vindices[2] = v+numvertices;
-                        nextTri.tindices[2] = t+numtexcoords;
-                        nextTri.nindices[2] = n+numnormals;
-                        
-                        mTriangles.push_back(nextTri);
-                        mGroups[group].triangles.push_back(numtriangles);
-                        numtriangles++;
-                        assert(mTriangles.size() == numtriangles);//check count
+                    if (options.texcoords) {
+                        triangle.tindices[slot] = objIndex(t, base[2],
+                                                           nextTexcoord);
                     }
-                } else if (sscanf(remain.c_str(), "%d/%d", &v, &t) == 2) {
-                    /* v/t */
-                    assert(v>0);assert(t>0);//do not accept negative indices
-                    triangle.vindices[0] = v+numvertices;
-                    triangle.tindices[0] = t+numtexcoords;
-                    
-                    sreader>>remain;
-                    sscanf(remain.c_str(), "%d/%d", &v, &t);
-                    assert(v>0);assert(t>0);//do not accept negative indices
-                    triangle.vindices[1] = v+numvertices;
-                    triangle.tindices[1] = t+numtexcoords;
-                    
-                    sreader>>remain;
-                    sscanf(remain.c_str(), "%d/%d", &v, &t);
-                    assert(v>0);assert(t>0);//do not accept negative indices
-                    triangle.vindices[2] = v+numvertices;
-                    triangle.tindices[2] = t+numtexcoords;
-                    
-                    mTriangles.push_back(triangle);
-                    mGroups[group].triangles.push_back(numtriangles);
-                    numtriangles++;
-                    assert(mTriangles.size() == numtriangles);//check count
-                    while(sreader>>remain) {
-                        AmTriangle nextTri(group);
-                        sscanf(remain.c_str(), "%d/%d", &v, &t);
-                        assert(v>0);assert(t>0);//do not accept negative indices
-                        nextTri.vindices[0] = triangle.vindices[0];
-                        nextTri.tindices[0] = triangle.tindices[0];
-                        nextTri.vindices[1] = triangle.vindices[2];
-                        nextTri.tindices[1] = triangle.tindices[2];
-                        nextTri.vindices[2] = v+numvertices;
-                        nextTri.tindices[2] = t+numtexcoords;
+                    count++;
+                    if (count >= 3) {
+                        mTriangles[nextTriangle++] = triangle;
                         
-                        mTriangles.push_back(nextTri);
-                        mGroups[group].triangles.push_back(numtriangles);
-                        numtriangles++;
-                        assert(mTriangles.size() == numtriangles);//check count
-                    }
-                    
-                } else {
-                    /* v */
-                    sscanf(remain.c_str(), "%d", &v);
-                    assert(v>0);//do not accept negative indices
-                    triangle.vindices[0] = v+numvertices;
-                    
-                    sreader>>remain;
-                    sscanf(remain.c_str(), "%d", &v);
-                    assert(v>0);//do not accept negative indices
-                    triangle.vindices[1] = v+numvertices;
-                    
-                    sreader>>remain;
-                    sscanf(remain.c_str(), "%d", &v);
-                    assert(v>0);//do not accept negative indices
-                    triangle.vindices[2] = v+numvertices;
-                    
-                    mTriangles.push_back(triangle);
-                    mGroups[group].triangles.push_back(numtriangles);
-                    numtriangles++;
-                    assert(mTriangles.size() == numtriangles);//check count
-                    while(sreader>>remain) {
-                        AmTriangle nextTri(group);
-                        sscanf(remain.c_str(), "%d", &v);
-                        assert(v>0);//do not accept negative indices
-                        nextTri.vindices[0] = triangle.vindices[0];
-                        nextTri.vindices[1] = triangle.vindices[2];
-                        nextTri.vindices[2] = v+numvertices;
-                        
-                        mTriangles.push_back(nextTri);
-                        mGroups[group].triangles.push_back(numtriangles);
-                        numtriangles++;
-                        assert(mTriangles.size() == numtriangles);//check count
+                        // the next one shares the first and the last vertex
+                        triangle.vindices[1] = triangle.vindices[2];
+                        triangle.tindices[1] = triangle.tindices[2];
+                        triangle.nindices[1] = triangle.nindices[2];
                     }
                 }
             }
                 break;
-            default:
+            default:                /* comment and the rest */
                 break;
         }
+        skipLine(p, end);
     }
+    assert(nextTriangle == chunk.first[AmObjChunk::TRIANGLES]
+                            + chunk.count[AmObjChunk::TRIANGLES]);
 }
 
 /*
  * find material index from its name
  */
-unsigned int AmModel::findMaterial(string name)
+unsigned int AmModel::findMaterial(const string &name)
 {
-    for (int i = 0; i < mMaterials.size(); i++) {
-        if (mMaterials[i].name == name) {
-            return i;
-        }
+    unordered_map<string, unsigned int>::const_iterator it
+        = mMaterialIndex.find(name);
+    if (it != mMaterialIndex.end()) {
+        return it->second;
     }
     
     cerr<<"can't find material: "<<name<<endl;
@@ -326,17 +692,60 @@ unsigned int AmModel::findMaterial(string name)
 /*
  * find group index from its name, if not exist, insert a new one with the name
  */
-unsigned int AmModel::findGroup(string name)
+unsigned int AmModel::findGroup(const string &name)
 {
     // group index starts from 0
-    for (int i = 0; i < mGroups.size(); i++) {
-        if (mGroups[i].name == name) {
-            return i;
-        }
+    unsigned int index = static_cast<unsigned int>(mGroups.size());
+    pair<unordered_map<string, unsigned int>::iterator, bool> found
+        = mGroupIndex.insert(make_pair(name, index));
+    if (found.second) {
+        mGroups.push_back(AmGroup(name));
+    }
+    return found.first->second;
+}
+
+/*
+ * append a material, a later one with the same name is never found
+ */
+unsigned int AmModel::addMaterial(const AmMaterial &material)
+{
+    unsigned int index = static_cast<unsigned int>(mMaterials.size());
+    mMaterials.push_back(material);
+    mMaterialIndex.insert(make_pair(material.name, index));
+    return index;
+}
+
+int AmModel::materialIndex(const string &name) const
+{
+    unordered_map<string, unsigned int>::const_iterator it
+        = mMaterialIndex.find(name);
+    return (it != mMaterialIndex.end()) ? static_cast<int>(it->second) : -1;
+}
+
+int AmModel::groupIndex(const string &name) const
+{
+    unordered_map<string, unsigned int>::const_iterator it
+        = mGroupIndex.find(name);
+    return (it != mGroupIndex.end()) ? static_cast<int>(it->second) : -1;
+}
+
+void AmModel::report(ostream &os) const
+{
+    os<<"model: "<<mTriangles.size()<<" triangles, "
+      <<mVertices.size() - 1<<" vertices, "<<mGroups.size()<<" groups, "
+      <<mMaterials.size() - 1<<" materials"<<endl;
+    if (mScene.data()) {
+        os<<"load: mapped scene file"<<endl;
+    } else {
+        os<<"load: count "<<mCountTime<<" s, commands "<<mCommandTime
+          <<" s ("<<mCommands<<" g/usemtl/mtllib lines), parse "
+          <<mParseTime<<" s"<<endl;
+    }
+    if (mWeldTime >= 0) {
+        os<<"weld: "<<mWeldVertices<<" vertices merged, "<<mWeldTriangles
+          <<" triangles dropped, "<<mWeldBytes<<" bytes saved, "
+          <<mWeldTime<<" s"<<endl;
     }
-    
-    mGroups.push_back(AmGroup(name));
-    return static_cast<unsigned int>(mGroups.size()-1);
 }
 
 
@@ -372,8 +781,7 @@ void AmModel::readMTL()
                 break;
             case 'n':               /* newmtl */
                 sreader>>first>>remain;
-                mMaterials.push_back(AmMaterial(remain));
-                material++;
+                material = addMaterial(AmMaterial(remain));
                 break;
             case 'd':
                 // transperancy
@@ -450,6 +858,12 @@ void AmModel::readMTL()
 //  Assumes a counter-clockwise winding.
 void AmModel::utilize()
 {
+    // a scene file holds a model which is utilized already
+    if (mUtilized) {
+        return;
+    }
+    mUtilized = true;
+    
     AmVec3f vmax(M_MIN, M_MIN, M_MIN);
     AmVec3f vmin(M_MAX, M_MAX, M_MAX);
     for (unsigned int i = 1; i < mVertices.size(); i++) {
@@ -494,8 +908,14 @@ void AmModel::utilize()
         mVertices[i].mData[2] *= scale;
     }
     
-    // get the normals and bounding boxes of triangles
+    updateTriangles();
+}
+
+// get the normals and bounding boxes of triangles
+void AmModel::updateTriangles()
+{
     mTriNorms.clear();
+    mTriNorms.reserve(mTriangles.size());
     for (unsigned int i = 0; i < mTriangles.size(); i++) {
         
         AmVec3f u = mVertices[mTriangles[i].vindices[1]]
@@ -533,6 +953,404 @@ void AmModel::utilize()
     }
 }
 
+// cell of the spatial hash of weld, neighbouring cells get different keys
+static unsigned long long weldCell(long long x, long long y, long long z)
+{
+    return (static_cast<unsigned long long>(x) * 73856093ULL)
+            ^ (static_cast<unsigned long long>(y) * 19349663ULL)
+            ^ (static_cast<unsigned long long>(z) * 83492791ULL);
+}
+
+// weld: merge the vertices closer than tolerance, and drop the triangles
+//  which have no area then.
+//  The kept vertices are hashed into a grid of cells, a vertex looks for
+//  one to merge with in the cells within the tolerance around it, and
+//  takes the earliest one in range.
+void AmModel::weld(float tolerance)
+{
+    AmTimer timer;
+    size_t oldVertices = mVertices.size(), oldTriangles = mTriangles.size();
+    size_t perTriangle = sizeof(AmTriangle) + sizeof(AmVec3f)
+                        + sizeof(unsigned int);
+    
+    // cells a few times larger than the tolerance, a vertex far enough
+    //  from the borders of its cell only looks into that one
+    float cellSize = max(4 * tolerance, 1e-5f);
+    float limit = tolerance * tolerance;
+    unordered_map<unsigned long long, unsigned int> cells; // first vertex
+    vector<unsigned int> nextInCell(mVertices.size(), 0);   // 0 ends a list
+    vector<unsigned int> remap(mVertices.size(), 0);
+    AmArray<AmVec3f> vertices;
+    vertices.reserve(mVertices.size());
+    vertices.push_back(mVertices[0]);   // the blank one
+    
+    for (unsigned int i = 1; i < mVertices.size(); i++) {
+        const AmVec3f &vertex = mVertices[i];
+        long long cell[3], low[3], high[3];
+        for (int a = 0; a < 3; a++) {
+            cell[a] = static_cast<long long>(floor(vertex.mData[a] / cellSize));
+            low[a] = static_cast<long long>(floor((vertex.mData[a] - tolerance)
+                                                  / cellSize));
+            high[a] = static_cast<long long>(floor((vertex.mData[a] + tolerance)
+                                                   / cellSize));
+        }
+        
+        unsigned int found = 0;
+        for (long long x = low[0]; x <= high[0]; x++) {
+            for (long long y = low[1]; y <= high[1]; y++) {
+                for (long long z = low[2]; z <= high[2]; z++) {
+                    unordered_map<unsigned long long, unsigned int>::
+                        const_iterator it = cells.find(weldCell(x, y, z));
+                    if (it == cells.end()) {
+                        continue;
+                    }
+                    for (unsigned int j = it->second; j != 0;
+                         j = nextInCell[j]) {
+                        AmVec3f d = mVertices[j] - vertex;
+                        if (d.dot(d) <= limit && (found == 0 || j < found)) {
+                            found = j;
+                        }
+                    }
+                }
+            }
+        }
+        
+        if (found != 0) {
+            remap[i] = remap[found];
+        } else {
+            remap[i] = static_cast<unsigned int>(vertices.size());
+            vertices.push_back(vertex);
+            unsigned int &head = cells[weldCell(cell[0], cell[1], cell[2])];
+            nextInCell[i] = head;
+            head = i;
+        }
+    }
+    
+    // the triangles which keep an area, and their new indices
+    vector<int> triangleRemap(mTriangles.size(), -1);
+    AmArray<AmTriangle> triangles;
+    triangles.reserve(mTriangles.size());
+    for (unsigned int i = 0; i < mTriangles.size(); i++) {
+        AmTriangle triangle = mTriangles[i];
+        for (int v = 0; v < 3; v++) {
+            triangle.vindices[v] = remap[triangle.vindices[v]];
+        }
+        AmVec3f u = vertices[triangle.vindices[1]] - vertices[triangle.vindices[0]];
+        AmVec3f w = vertices[triangle.vindices[2]] - vertices[triangle.vindices[0]];
+        AmVec3f normal = u.cross(w);
+        if (normal.dot(normal) == 0) {
+            continue;
+        }
+        triangleRemap[i] = static_cast<int>(triangles.size());
+        triangles.push_back(triangle);
+    }
+    for (size_t g = 0; g < mGroups.size(); g++) {
+        AmArray<unsigned int> list;
+        for (size_t i = 0; i < mGroups[g].triangles.size(); i++) {
+            int t = triangleRemap[mGroups[g].triangles[i]];
+            if (t >= 0) {
+                list.push_back(static_cast<unsigned int>(t));
+            }
+        }
+        mGroups[g].triangles = list;
+    }
+    
+    mVertices = vertices;
+    mTriangles = triangles;
+    updateTriangles();
+    
+    mWeldVertices = oldVertices - mVertices.size();
+    mWeldTriangles = oldTriangles - mTriangles.size();
+    mWeldBytes = mWeldVertices * sizeof(AmVec3f) + mWeldTriangles * perTriangle;
+    mWeldTime = timer.elapsed();
+    mEditHash = CommonFuncs::hashFNV(&tolerance, sizeof(tolerance), mEditHash);
+}
+
+
+
+//////Binary Scene File///////////
+
+// sections of a scene file, in the order they are written
+enum AmSceneSection
+{
+    SCENE_VERTICES,
+    SCENE_NORMALS,
+    SCENE_TEXCOORDS,
+    SCENE_TRIANGLES,
+    SCENE_TRINORMS,
+    SCENE_GROUP_TRIANGLES,  // the triangle lists of all the groups
+    SCENE_MATERIALS,
+    SCENE_GROUPS,
+    SCENE_NAMES,            // characters of the material and group names
+    SCENE_SECTIONS
+};
+
+static const char SCENE_MAGIC[8] = {'A', 'M', 'S', 'C', 'E', 'N', 'E', 0};
+static const size_t SCENE_ALIGN = 16;
+
+// head of a scene file, every section starts at an aligned offset so
+//  the arrays can be used in place
+struct AmSceneHeader
+{
+    char                magic[8];       // "AMSCENE"
+    unsigned int        version;
+    unsigned int        triangleSize;   // sizeof(AmTriangle) of the writer
+    unsigned long long  offset[SCENE_SECTIONS];
+    unsigned long long  count[SCENE_SECTIONS];
+};
+
+struct AmSceneMaterial
+{
+    float               diffuse[4];
+    float               ambient[4];
+    float               specular[4];
+    float               emmissive[4];
+    float               shininess;
+    float               transperancy;
+    float               density;
+    int                 illum;
+    unsigned long long  name;           // offset in the names
+    unsigned long long  nameLength;
+};
+
+struct AmSceneGroup
+{
+    unsigned long long  name;
+    unsigned long long  nameLength;
+    unsigned long long  first;          // offset in the group triangles
+    unsigned long long  count;
+    unsigned int        material;
+    unsigned int        reserved;
+};
+
+// bytes of an element of each section
+static const size_t sceneElementSize[SCENE_SECTIONS] = {
+    sizeof(AmVec3f), sizeof(AmVec3f), sizeof(AmVec2f), sizeof(AmTriangle),
+    sizeof(AmVec3f), sizeof(unsigned int), sizeof(AmSceneMaterial),
+    sizeof(AmSceneGroup), sizeof(char)
+};
+
+static size_t alignScene(size_t offset)
+{
+    return (offset + SCENE_ALIGN - 1) / SCENE_ALIGN * SCENE_ALIGN;
+}
+
+bool AmModel::isScene(const string &filename)
+{
+    ifstream ifs(filename.c_str(), ios::binary);
+    char magic[8];
+    return ifs.read(magic, sizeof(magic))
+            && memcmp(magic, SCENE_MAGIC, sizeof(magic)) == 0;
+}
+
+bool AmModel::writeScene(const string &filename) const
+{
+    // the small records and their names
+    string names;
+    vector<AmSceneMaterial> materials(mMaterials.size());
+    for (size_t i = 0; i < mMaterials.size(); i++) {
+        const AmMaterial &m = mMaterials[i];
+        AmSceneMaterial &record = materials[i];
+        memset(&record, 0, sizeof(record));
+        memcpy(record.diffuse, m.diffuse, sizeof(record.diffuse));
+        memcpy(record.ambient, m.ambient, sizeof(record.ambient));
+        memcpy(record.specular, m.specular, sizeof(record.specular));
+        memcpy(record.emmissive, m.emmissive, sizeof(record.emmissive));
+        record.shininess = m.shininess;
+        record.transperancy = m.transperancy;
+        record.density = m.density;
+        record.illum = m.illum;
+        record.name = names.size();
+        record.nameLength = m.name.size();
+        names += m.name;
+    }
+    vector<AmSceneGroup> groups(mGroups.size());
+    size_t groupTriangles = 0;
+    for (size_t i = 0; i < mGroups.size(); i++) {
+        AmSceneGroup &record = groups[i];
+        memset(&record, 0, sizeof(record));
+        record.name = names.size();
+        record.nameLength = mGroups[i].name.size();
+        record.first = groupTriangles;
+        record.count = mGroups[i].triangles.size();
+        record.material = mGroups[i].material;
+        names += mGroups[i].name;
+        groupTriangles += mGroups[i].triangles.size();
+    }
+    
+    const void *data[SCENE_SECTIONS] = {
+        mVertices.data(), mNormals.data(), mTexcoords.data(),
+        mTriangles.data(), mTriNorms.data(), 0,
+        materials.data(), groups.data(), names.data()
+    };
+    size_t count[SCENE_SECTIONS] = {
+        mVertices.size(), mNormals.size(), mTexcoords.size(),
+        mTriangles.size(), mTriNorms.size(), groupTriangles,
+        materials.size(), groups.size(), names.size()
+    };
+    
+    AmSceneHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SCENE_MAGIC, sizeof(header.magic));
+    header.version = SCENE_VERSION;
+    header.triangleSize = sizeof(AmTriangle);
+    size_t offset = alignScene(sizeof(header));
+    for (int s = 0; s < SCENE_SECTIONS; s++) {
+        header.offset[s] = offset;
+        header.count[s] = count[s];
+        offset = alignScene(offset + count[s] * sceneElementSize[s]);
+    }
+    
+    ofstream ofs(filename.c_str(), ios::binary);
+    if (!ofs) {
+        return false;
+    }
+    const char zeros[SCENE_ALIGN] = {0};
+    ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (int s = 0; s < SCENE_SECTIONS; s++) {
+        ofs.write(zeros, header.offset[s] - ofs.tellp());
+        if (s == SCENE_GROUP_TRIANGLES) {
+            for (size_t i = 0; i < mGroups.size(); i++) {
+                ofs.write(reinterpret_cast<const char *>(
+                                            mGroups[i].triangles.data()),
+                          mGroups[i].triangles.size() * sizeof(unsigned int));
+            }
+        } else {
+            ofs.write(static_cast<const char *>(data[s]),
+                      count[s] * sceneElementSize[s]);
+        }
+    }
+    ofs.write(zeros, offset - ofs.tellp());
+    return static_cast<bool>(ofs);
+}
+
+// map the file and point the arrays into it, only the materials and
+//  the groups are copied. The indices are checked once, which is the
+//  only pass over the data before the accelerator reads it
+bool AmModel::readScene(const string &filename)
+{
+    mTriangles.clear();
+    mVertices.clear();
+    mNormals.clear();
+    mTriNorms.clear();
+    mTexcoords.clear();
+    mMaterials.clear();
+    mGroups.clear();
+    mMaterialIndex.clear();
+    mGroupIndex.clear();
+    
+    // copy on write, so the model can still be changed after loading
+    if (!mScene.open(filename, true) || mScene.size() < sizeof(AmSceneHeader)) {
+        return false;
+    }
+    AmSceneHeader header;
+    memcpy(&header, mScene.data(), sizeof(header));
+    if (memcmp(header.magic, SCENE_MAGIC, sizeof(header.magic)) != 0
+        || header.version != SCENE_VERSION
+        || header.triangleSize != sizeof(AmTriangle)) {
+        mScene.close();
+        return false;
+    }
+    for (int s = 0; s < SCENE_SECTIONS; s++) {
+        if (header.offset[s] % SCENE_ALIGN != 0
+            || header.offset[s] > mScene.size()
+            || header.count[s] > (mScene.size() - header.offset[s])
+                                    / sceneElementSize[s]) {
+            mScene.close();
+            return false;
+        }
+    }
+    
+    char *data = mScene.data();
+    size_t nv = header.count[SCENE_VERTICES];
+    size_t nn = header.count[SCENE_NORMALS];
+    size_t nt = header.count[SCENE_TEXCOORDS];
+    size_t ntri = header.count[SCENE_TRIANGLES];
+    size_t ngt = header.count[SCENE_GROUP_TRIANGLES];
+    size_t nm = header.count[SCENE_MATERIALS];
+    size_t ng = header.count[SCENE_GROUPS];
+    size_t nnames = header.count[SCENE_NAMES];
+    const AmSceneMaterial *materials = reinterpret_cast<const AmSceneMaterial *>(
+                                        data + header.offset[SCENE_MATERIALS]);
+    const AmSceneGroup *groups = reinterpret_cast<const AmSceneGroup *>(
+                                        data + header.offset[SCENE_GROUPS]);
+    const char *names = data + header.offset[SCENE_NAMES];
+    unsigned int *groupTriangles = reinterpret_cast<unsigned int *>(
+                                    data + header.offset[SCENE_GROUP_TRIANGLES]);
+    
+    // index 0 of the vertices, normals and texcoords is the blank one
+    bool valid = (nv > 0 && nn > 0 && nt > 0 && nm > 0
+                  && header.count[SCENE_TRINORMS] == ntri);
+    for (size_t i = 0; valid && i < nm; i++) {
+        valid = (materials[i].name <= nnames
+                 && materials[i].nameLength <= nnames - materials[i].name);
+    }
+    for (size_t i = 0; valid && i < ng; i++) {
+        valid = (groups[i].name <= nnames
+                 && groups[i].nameLength <= nnames - groups[i].name
+                 && groups[i].first <= ngt
+                 && groups[i].count <= ngt - groups[i].first
+                 && groups[i].material < nm);
+    }
+    for (size_t i = 0; valid && i < ngt; i++) {
+        valid = (groupTriangles[i] < ntri);
+    }
+    const AmTriangle *triangles = reinterpret_cast<const AmTriangle *>(
+                                    data + header.offset[SCENE_TRIANGLES]);
+    for (size_t i = 0; valid && i < ntri; i++) {
+        const AmTriangle &t = triangles[i];
+        valid = (t.group < ng);
+        for (int v = 0; v < 3; v++) {
+            valid = valid && t.vindices[v] < nv && t.nindices[v] < nn
+                    && t.tindices[v] < nt;
+        }
+    }
+    if (!valid) {
+        mScene.close();
+        return false;
+    }
+    
+    mVertices.view(reinterpret_cast<AmVec3f *>(
+                    data + header.offset[SCENE_VERTICES]), nv);
+    mNormals.view(reinterpret_cast<AmVec3f *>(
+                    data + header.offset[SCENE_NORMALS]), nn);
+    mTexcoords.view(reinterpret_cast<AmVec2f *>(
+                    data + header.offset[SCENE_TEXCOORDS]), nt);
+    mTriangles.view(reinterpret_cast<AmTriangle *>(
+                    data + header.offset[SCENE_TRIANGLES]), ntri);
+    mTriNorms.view(reinterpret_cast<AmVec3f *>(
+                    data + header.offset[SCENE_TRINORMS]), ntri);
+    
+    mMaterials.reserve(nm);
+    for (size_t i = 0; i < nm; i++) {
+        const AmSceneMaterial &record = materials[i];
+        AmMaterial m(string(names + record.name, record.nameLength));
+        memcpy(m.diffuse, record.diffuse, sizeof(m.diffuse));
+        memcpy(m.ambient, record.ambient, sizeof(m.ambient));
+        memcpy(m.specular, record.specular, sizeof(m.specular));
+        memcpy(m.emmissive, record.emmissive, sizeof(m.emmissive));
+        m.shininess = record.shininess;
+        m.transperancy = record.transperancy;
+        m.density = record.density;
+        m.illum = record.illum;
+        addMaterial(m);
+    }
+    mGroups.reserve(ng);
+    for (size_t i = 0; i < ng; i++) {
+        const AmSceneGroup &record = groups[i];
+        string name(names + record.name, record.nameLength);
+        mGroupIndex.insert(make_pair(name, static_cast<unsigned int>(i)));
+        mGroups.push_back(AmGroup(name));
+        mGroups.back().material = record.material;
+        mGroups.back().triangles.view(groupTriangles + record.first,
+                                      record.count);
+    }
+    
+    mMtllibname.clear();
+    mUtilized = true;
+    return true;
+}
+
 
 //////Camera Class///////////
 void AmCamera::update()
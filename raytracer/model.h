@@ -15,12 +15,18 @@
 #define raytracer_model_h
 
 #include "utils.h"
+#include "array.h"
+#include "mapfile.h"
+#include "threadpool.h"
 
 #include <fstream>
+#include <unordered_map>
 
 
 namespace raytracer {
     
+    class AmObjChunk;
+    
     /*
      * AmMaterial: class that defines a material in a model.
      *  See:
@@ -67,6 +73,7 @@ namespace raytracer {
             shininess(65.0),
             transperancy(1),
             density(1.0),
+            illum(2),
             name("__AM_FIRST_BLANK_MATERIAL__") // never used in real scene
         {}
         
@@ -78,6 +85,7 @@ namespace raytracer {
             shininess(65.0),
             transperancy(1),
             density(1.0),
+            illum(2),
             name(n)
         {}
     };
@@ -107,7 +115,7 @@ namespace raytracer {
         
     public:
         string          name;               /* name of this group */
-        vector<unsigned int>    triangles;  /* array of triangle indices */
+        AmArray<unsigned int>   triangles;  /* array of triangle indices */
         unsigned int    material;           /* index to material for group */
         
         
@@ -117,6 +125,23 @@ namespace raytracer {
     };
     
     
+    /*
+     * AmLoadOptions: how an obj file is loaded
+     */
+    class AmLoadOptions {
+        
+    public:
+        int     threads;        // threads which parse the file
+        bool    normals;        // keep the vertex normals and texcoords,
+        bool    texcoords;      //  only the OpenGL view draws with them
+        size_t  memoryLimit;    // bytes of the model arrays plus the text
+                                //  being parsed, 0 for no limit
+        
+        AmLoadOptions(int t = 1)
+            :threads(t), normals(true), texcoords(true), memoryLimit(0)
+        {}
+    };
+    
     /*
      * AmModel: class that stores all info of the scene model
      */
@@ -124,27 +149,96 @@ namespace raytracer {
         
         string mPathname;
         string mMtllibname;                 // name of the material library
+        AmMappedFile mScene;                // the scene file viewed by arrays
+        bool mUtilized;
+        
+        // indices of the materials and the groups by their names
+        unordered_map<string, unsigned int> mMaterialIndex;
+        unordered_map<string, unsigned int> mGroupIndex;
+        
+        // seconds of the passes of the last obj file, and the number of
+        //  g/usemtl/mtllib lines replayed between them
+        double mCountTime, mCommandTime, mParseTime;
+        size_t mCommands;
+        
+        // result of the last weld, mWeldTime is negative before any
+        size_t mWeldVertices, mWeldTriangles, mWeldBytes;
+        double mWeldTime;
+        
+        unsigned long long mEditHash;       // of the changes after loading
     
     public:
-        vector<AmTriangle>  mTriangles;     // triangles of the scene
-        vector<AmVec3f>     mVertices;
-        vector<AmVec3f>     mNormals;       // normals of vertex
-        vector<AmVec3f>     mTriNorms;      // normals of triangles
-        vector<AmVec2f>     mTexcoords;
+        // version of the binary scene files written by writeScene
+        static const unsigned int SCENE_VERSION = 1;
+        // smallest piece of an obj file parsed by one thread
+        static const size_t CHUNK_SIZE = 1 << 20;
+        
+        AmArray<AmTriangle> mTriangles;     // triangles of the scene
+        AmArray<AmVec3f>    mVertices;
+        AmArray<AmVec3f>    mNormals;       // normals of vertex
+        AmArray<AmVec3f>    mTriNorms;      // normals of triangles
+        AmArray<AmVec2f>    mTexcoords;
         vector<AmMaterial>  mMaterials;
         vector<AmGroup>     mGroups;
         
     public:
-        AmModel(string pathname);
+        // read a wavefront obj file with the given number of threads,
+        //  or a binary scene file
+        AmModel(string pathname, int threads = 1);
+        AmModel(string pathname, const AmLoadOptions &options);
         
-        void readOBJ(string filename);
+        const string &getPathname() const
+        {
+            return mPathname;
+        }
+        
+        // path of the material library, empty if there is none
+        string getMtlPathname() const
+        {
+            if (mMtllibname.empty()) {
+                return "";
+            }
+            return CommonFuncs::getDirName(mPathname) + mMtllibname;
+        }
+        
+        // index of the material or the group with the name,
+        //  -1 if there is none
+        int materialIndex(const string &name) const;
+        int groupIndex(const string &name) const;
+        
+        // sizes of the model and the time of loading it
+        void report(ostream &os) const;
+        
+        bool readOBJ(string filename,
+                     const AmLoadOptions &options = AmLoadOptions());
         void utilize();
+        
+        // merge the vertices closer than tolerance after utilize(), and
+        //  drop the triangles which become degenerate
+        void weld(float tolerance);
+        
+        // hash of the changes made to the model after it was read, the
+        //  kd-tree cache keys on it besides the files
+        unsigned long long editHash() const
+        {
+            return mEditHash;
+        }
+        
+        // binary scene file: the arrays after utilize(), read back by
+        //  mapping the file, the arrays view it in place
+        static bool isScene(const string &filename);
+        bool readScene(const string &filename);
+        bool writeScene(const string &filename) const;
 
     private:
-        void pass(ifstream &ifs);
-        unsigned int findMaterial(string name);
-        unsigned int findGroup(string name);
+        bool pass(AmMappedFile &file, const AmLoadOptions &options);
+        void parseChunk(const AmObjChunk &chunk, const unsigned int base[3],
+                        const AmLoadOptions &options);
+        unsigned int findMaterial(const string &name);
+        unsigned int findGroup(const string &name);
+        unsigned int addMaterial(const AmMaterial &material);
         void readMTL();
+        void updateTriangles();
         
     };
     
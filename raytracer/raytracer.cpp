@@ -9,41 +9,489 @@
 #include "raytracer.h"
 #include "model.h"
 
+#include <limits>
+
 using namespace std;
 using namespace raytracer;
 
 
 
 // constructor of the ray, generate a ray from the camera, at pixel [w,h]
-AmRay::AmRay(const AmCameraPtr &camera, int w, int h)
+AmRay::AmRay(const AmCameraPtr &camera, float w, float h)
 {
     orig = camera->eye;
     dir = camera->base + (camera->vecx * w) + (camera->vecy * h) - orig;
     dir.normalize();
+    prepare();
+}
+
+
+void AmRayTracer::setModel(const AmModelPtr &m)
+{
+    AmTimer timer;
+    setModelAccel(m);
+    stats.times[AmStats::AM_BUILD] += timer.elapsed();
 }
 
+void AmRayTracer::setModelAccel(const AmModelPtr &m)
+{
+    model = m;
+    switch (accelType) {
+        case AmAccelerator::AM_BRUTE_FORCE:
+            accel = AmAcceleratorPtr(new AmBruteForce);
+            break;
+        case AmAccelerator::AM_BVH:
+            accel = AmAcceleratorPtr(new AmBVH);
+            break;
+        default: {
+            AmKDTree *tree = new AmKDTree(kdHeuristic);
+            tree->setThreadPool(pool);
+            accel = AmAcceleratorPtr(tree);
+            if (!cacheDir.empty()) {
+                tree->setModel(m);
+                tree->initCached(cacheDir);
+                return;
+            }
+            break;
+        }
+    }
+    accel->setModel(m);
+    accel->init();
+}
+
+void AmRayTracer::setThreads(int n)
+{
+    if (n <= 0) {
+        n = AmThreadPool::hardwareThreads();
+    }
+    threads = n;
+    if (threads > 1 && (!pool || pool->size() != threads)) {
+        pool = AmThreadPoolPtr(new AmThreadPool(threads));
+    } else if (threads <= 1) {
+        pool.reset();
+    }
+}
 
 // render the model with the camera info, put the result into buffer
+//  the frame is cut into tiles which are drained by the thread pool,
+//  every pixel is written by exactly one tile, so no locking is needed
 void AmRayTracer::render(AmUintPtr &pixels)
 {
-    int idx = 0;
-    for (int h = 0; h < camera->height; h++) {
-        for (int w = 0; w < camera->width; w++) {
-            AmRay ray(camera, w, h);
+    unsigned int *buffer = pixels.get();
+    size_t size = static_cast<size_t>(camera->width) * camera->height;
+    if (reprojection && samplesKept.size() != size) {
+        samplesKept.assign(size, AmPixelSample());
+    }
+    int *prims = 0;
+    if (samples > 1) {
+        primary.resize(camera->width * camera->height);
+        prims = &primary[0];
+    }
+    runTiles(AmStats::AM_TRACE, 0, camera->height, 1,
+             [=](int x0, int y0, int x1, int y1) {
+        renderTile(buffer, prims, x0, y0, x1, y1);
+    });
+    
+    refined = 0;
+    if (samples > 1) {
+        antialias(buffer);
+    }
+}
 
+void AmRayTracer::renderStride(AmUintPtr &pixels, int stride, int y0, int y1)
+{
+    unsigned int *buffer = pixels.get();
+    size_t size = static_cast<size_t>(camera->width) * camera->height;
+    if (reprojection && samplesKept.size() != size) {
+        samplesKept.assign(size, AmPixelSample());
+    }
+    y0 = max(y0, 0);
+    y1 = min(y1, camera->height);
+    runTiles(AmStats::AM_TRACE, y0, y1, stride,
+             [=](int x0, int ty0, int x1, int ty1) {
+        renderTileStride(buffer, stride, x0, ty0, x1, ty1);
+    });
+}
+
+// the tile origins are multiples of align, so the blocks of a stride
+//  never straddle two tiles. A task counts into the slot of its worker
+void AmRayTracer::runTiles(AmStats::AmPhase phase, int y0, int y1, int align,
+                           const AmTileFunc &f)
+{
+    AmTimer timer;
+    size_t workers = pool ? pool->size() : 1;
+    if (slots.size() < workers) {
+        slots.resize(workers);
+    }
+    
+    if (!pool) {
+        AmCounters *previous = AmCounters::current();
+        AmCounters::current() = &slots[0];
+        f(0, y0, camera->width, y1);
+        AmCounters::current() = previous;
+    } else {
+        int size = max(tileSize / align, 1) * align;
+        AmCounters *counters = &slots[0];
+        vector<AmThreadPool::AmTask> tiles;
+        for (int y = y0; y < y1; y += size) {
+            for (int x = 0; x < camera->width; x += size) {
+                int x1 = min(x + size, camera->width);
+                int ty1 = min(y + size, y1);
+                tiles.push_back([=, &f](int worker) {
+                    AmCounters::current() = &counters[worker];
+                    f(x, y, x1, ty1);
+                    AmCounters::current() = 0;
+                });
+            }
+        }
+        pool->run(tiles);
+    }
+    
+    for (size_t i = 0; i < workers; i++) {
+        stats.counters.merge(slots[i]);
+        slots[i].clear();
+    }
+    stats.times[phase] += timer.elapsed();
+}
+
+// pack the color into a pixel of the buffer
+static unsigned int colorToPixel(AmVec3f color)
+{
+    // clamp the channel, so a color out of [0, 1] can't overflow into
+    //  the next byte
+    unsigned int value = static_cast<unsigned int>(
+                            min(max(color.x() * 255, 0.0f), 255.0f));
+    return value | (value << 8) | (value << 16);
+}
+
+// the color of a pixel, the middle of the range colorToPixel truncated
+static AmVec3f pixelToColor(unsigned int pixel)
+{
+    return AmVec3f((pixel & 0xff) + 0.5f, ((pixel >> 8) & 0xff) + 0.5f,
+                   ((pixel >> 16) & 0xff) + 0.5f) / 255;
+}
+
+// render the pixels in [x0, x1) x [y0, y1), keep the triangles hit
+//  in prims unless it is null
+void AmRayTracer::renderTile(unsigned int *pixels, int *prims,
+                             int x0, int y0, int x1, int y1)
+{
+    if (packetSize <= 1 || maxDepth <= 0) {
+        for (int h = y0; h < y1; h++) {
+            int idx = h * camera->width + x0;
+            for (int w = x0; w < x1; w++) {
+                AmRay ray(camera, w, h);
+                int minMesh;
+                float hit;
+                pixels[idx] = colorToPixel(primaryRay(ray, hit, minMesh));
+                if (prims) {
+                    prims[idx] = minMesh;
+                }
+                if (keeping()) {
+                    keepSample(idx, ray, hit, pixels[idx]);
+                }
+                idx += 1;
+            }
+        }
+        return;
+    }
+    
+    // trace the primary rays of a block of pixels together,
+    //  then shade them one by one
+    float hits[AmRayPacket::MAX_SIZE];
+    int indices[AmRayPacket::MAX_SIZE];
+    for (int by = y0; by < y1; by += packetSize) {
+        for (int bx = x0; bx < x1; bx += packetSize) {
+            int ex = min(bx + packetSize, x1);
+            int ey = min(by + packetSize, y1);
+            AmRayPacket packet;
+            for (int h = by; h < ey; h++) {
+                for (int w = bx; w < ex; w++) {
+                    packet.push(AmRay(camera, w, h));
+                }
+            }
+            AmCounters::count(AmCounters::AM_PRIMARY_RAYS, packet.size);
+            accel->searchPacket(packet, hits, indices);
             
-            AmVec3f color = rayTracing(ray, maxDepth);
-            
-            color = color * 255;
-            pixels.get()[idx] = static_cast<unsigned int>(color.x()) |
-                        (static_cast<unsigned int>(color.x()) << 8) |
-                        (static_cast<unsigned int>(color.x()) << 16);
-            
-            idx += 1;
+            int k = 0;
+            for (int h = by; h < ey; h++) {
+                for (int w = bx; w < ex; w++, k++) {
+                    AmVec3f color = shade(packet.ray(k), hits[k], indices[k],
+                                          maxDepth);
+                    int idx = h * camera->width + w;
+                    pixels[idx] = colorToPixel(color);
+                    if (prims) {
+                        prims[idx] = indices[k];
+                    }
+                    if (keeping()) {
+                        keepSample(idx, packet.ray(k), hits[k], pixels[idx]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// whether two pixels differ by more than limit in a channel
+static bool contrasts(unsigned int a, unsigned int b, int limit)
+{
+    for (int shift = 0; shift < 24; shift += 8) {
+        int ca = (a >> shift) & 0xff;
+        int cb = (b >> shift) & 0xff;
+        if (abs(ca - cb) > limit) {
+            return true;
         }
     }
+    return false;
 }
 
+// find the pixels that differ from a neighbour in color or in the
+//  triangle hit, then trace more rays for them. All the edges are found
+//  before any pixel changes, the tiles read their neighbours
+void AmRayTracer::antialias(unsigned int *pixels)
+{
+    int width = camera->width;
+    int height = camera->height;
+    edges.assign(width * height, 0);
+    unsigned char *marks = &edges[0];
+    const int *prims = &primary[0];
+    int limit = static_cast<int>(contrast * 255);
+    
+    runTiles(AmStats::AM_ANTIALIAS, 0, height, 1,
+             [=](int x0, int y0, int x1, int y1) {
+        for (int h = y0; h < y1; h++) {
+            for (int w = x0; w < x1; w++) {
+                int idx = h * width + w;
+                const int neighbours[4] = {
+                    w > 0 ? idx - 1 : idx, w + 1 < width ? idx + 1 : idx,
+                    h > 0 ? idx - width : idx, h + 1 < height ? idx + width : idx
+                };
+                for (int i = 0; i < 4; i++) {
+                    int n = neighbours[i];
+                    if (prims[n] != prims[idx]
+                        || contrasts(pixels[n], pixels[idx], limit)) {
+                        marks[idx] = 1;
+                        break;
+                    }
+                }
+            }
+        }
+    });
+    
+    refined = count(edges.begin(), edges.end(), 1);
+    if (refined == 0) {
+        return;
+    }
+    runTiles(AmStats::AM_ANTIALIAS, 0, height, 1,
+             [=](int x0, int y0, int x1, int y1) {
+        antialiasTile(pixels, x0, y0, x1, y1);
+    });
+}
+
+// reproducible jitter in [0, 1) of sample s of pixel i
+static float jitter(unsigned int i, unsigned int s)
+{
+    unsigned int h = i * 0x9e3779b1u ^ s * 0x85ebca77u;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return (h >> 8) * (1.0f / 16777216.0f);
+}
+
+// the pixel is cut into n x n strata with a jittered ray in each, the
+//  first sample at the corner of the pixel already covers the first
+//  stratum
+void AmRayTracer::antialiasTile(unsigned int *pixels,
+                                int x0, int y0, int x1, int y1)
+{
+    int n = static_cast<int>(sqrt(static_cast<float>(samples)));
+    float size = 1.0f / n;
+    for (int h = y0; h < y1; h++) {
+        for (int w = x0; w < x1; w++) {
+            int idx = h * camera->width + w;
+            if (!edges[idx]) {
+                continue;
+            }
+            AmVec3f color = pixelToColor(pixels[idx]);
+            AmCounters::count(AmCounters::AM_PRIMARY_RAYS, n * n - 1);
+            for (int s = 1; s < n * n; s++) {
+                float dx = (s % n + jitter(idx, 2 * s)) * size;
+                float dy = (s / n + jitter(idx, 2 * s + 1)) * size;
+                AmRay ray(camera, w + dx, h + dy);
+                color = color + rayTracing(ray, maxDepth);
+            }
+            pixels[idx] = colorToPixel(color / static_cast<float>(n * n));
+            if (keeping()) {
+                samplesKept[idx].color = pixels[idx];
+            }
+        }
+    }
+}
+
+// the block at (x, y) takes the color of the ray through its corner,
+//  the corners on the grid of stride * 2 were traced by the coarser pass
+//  and only spread their color
+void AmRayTracer::renderTileStride(unsigned int *pixels, int stride,
+                                   int x0, int y0, int x1, int y1)
+{
+    int width = camera->width;
+    int coarse = stride * 2;
+    for (int y = y0 - y0 % stride; y < y1; y += stride) {
+        for (int x = x0 - x0 % stride; x < x1; x += stride) {
+            unsigned int pixel;
+            if (stride < COARSE_STRIDE && x % coarse == 0 && y % coarse == 0) {
+                pixel = pixels[y * width + x];
+            } else {
+                AmRay ray(camera, x, y);
+                int minMesh;
+                float hit;
+                pixel = colorToPixel(primaryRay(ray, hit, minMesh));
+                if (keeping()) {
+                    keepSample(y * width + x, ray, hit, pixel);
+                }
+            }
+            int ey = min(y + stride, y1);
+            int ex = min(x + stride, x1);
+            for (int h = max(y, y0); h < ey; h++) {
+                for (int w = max(x, x0); w < ex; w++) {
+                    pixels[h * width + w] = pixel;
+                }
+            }
+        }
+    }
+}
+
+// keep the primary ray of pixel idx and its color for the reprojection
+void AmRayTracer::keepSample(int idx, const AmRay &ray, float hit,
+                             unsigned int pixel)
+{
+    AmPixelSample &sample = samplesKept[idx];
+    sample.color = pixel;
+    if (hit > EPSILON) {
+        sample.point = ray.orig + ray.dir * hit;
+        sample.state = AmPixelSample::AM_HIT;
+    } else {
+        sample.point = ray.dir;
+        sample.state = AmPixelSample::AM_MISS;
+    }
+}
+
+// the samples are splatted to the pixel whose corner is nearest to their
+//  projection, the nearest sample wins; the misses are points at infinity
+//  and move with the direction only. Splatting is serial, a sample costs
+//  a projection, the pixels left over are traced by the tiles
+void AmRayTracer::reproject(AmUintPtr &pixels)
+{
+    int width = camera->width;
+    int height = camera->height;
+    size_t size = static_cast<size_t>(width) * height;
+    if (!reprojection || samplesKept.size() != size) {
+        bool keep = reprojection;
+        reprojection = true;
+        render(pixels);
+        reprojection = keep;
+        traced = size;
+        return;
+    }
+    
+    AmTimer timer;
+    const float FAR = numeric_limits<float>::infinity();
+    const float DEPTH_RATIO = 1.1f;    // farther than a neighbour by this
+    vector<float> depths(size, FAR);
+    vector<int> sources(size, -1);
+    
+    float distance = (camera->center - camera->eye).dot(camera->dir);
+    float lengthX = camera->vecx.dot(camera->vecx);
+    float lengthY = camera->vecy.dot(camera->vecy);
+    for (size_t i = 0; i < size; i++) {
+        const AmPixelSample &sample = samplesKept[i];
+        if (sample.state == AmPixelSample::AM_EMPTY) {
+            continue;
+        }
+        bool hit = (sample.state == AmPixelSample::AM_HIT);
+        AmVec3f d = hit ? sample.point - camera->eye : sample.point;
+        float z = d.dot(camera->dir);
+        if (z <= EPSILON) {
+            continue;   // behind the camera
+        }
+        AmVec3f plane = camera->eye + d * (distance / z) - camera->base;
+        float u = plane.dot(camera->vecx) / lengthX;
+        float v = plane.dot(camera->vecy) / lengthY;
+        int x = static_cast<int>(floor(u + 0.5f));
+        int y = static_cast<int>(floor(v + 0.5f));
+        if (x < 0 || x >= width || y < 0 || y >= height) {
+            continue;
+        }
+        int idx = y * width + x;
+        float depth = hit ? z : FAR;
+        if (sources[idx] < 0 || depth < depths[idx]) {
+            depths[idx] = depth;
+            sources[idx] = static_cast<int>(i);
+        }
+    }
+    
+    // a sample much farther than a neighbour shows through a crack
+    //  of a surface in front of it, or lies at a silhouette
+    vector<AmPixelSample> warped(size);
+    vector<unsigned char> holes(size, 0);
+    traced = 0;
+    unsigned int *buffer = pixels.get();
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int idx = y * width + x;
+            bool hole = (sources[idx] < 0);
+            const int neighbours[4] = {
+                x > 0 ? idx - 1 : idx, x + 1 < width ? idx + 1 : idx,
+                y > 0 ? idx - width : idx, y + 1 < height ? idx + width : idx
+            };
+            for (int i = 0; i < 4 && !hole; i++) {
+                hole = (depths[idx] > depths[neighbours[i]] * DEPTH_RATIO);
+            }
+            if (hole) {
+                holes[idx] = 1;
+                traced++;
+            } else {
+                warped[idx] = samplesKept[sources[idx]];
+                buffer[idx] = warped[idx].color;
+            }
+        }
+    }
+    samplesKept.swap(warped);
+    stats.times[AmStats::AM_REPROJECT] += timer.elapsed();
+    
+    const unsigned char *marks = &holes[0];
+    runTiles(AmStats::AM_TRACE, 0, height, 1,
+             [=](int x0, int y0, int x1, int y1) {
+        for (int h = y0; h < y1; h++) {
+            for (int w = x0; w < x1; w++) {
+                int idx = h * width + w;
+                if (!marks[idx]) {
+                    continue;
+                }
+                AmRay ray(camera, w, h);
+                int minMesh;
+                float hit;
+                buffer[idx] = colorToPixel(primaryRay(ray, hit, minMesh));
+                keepSample(idx, ray, hit, buffer[idx]);
+            }
+        }
+    });
+}
+
+// like rayTracing, also gives the hit and the triangle of the ray
+AmVec3f AmRayTracer::primaryRay(const AmRay &ray, float &hit, int &minMesh)
+{
+    hit = 0;
+    minMesh = -1;
+    if (maxDepth <= 0) {
+        return AmVec3f(0, 0, 0);
+    }
+    AmCounters::count(AmCounters::AM_PRIMARY_RAYS);
+    hit = accel->search(ray, minMesh);
+    return shade(ray, hit, minMesh, maxDepth);
+}
 
 // ray tracing and set the value to color
 AmVec3f AmRayTracer::rayTracing(const AmRay &ray, const int depth)
@@ -56,10 +504,17 @@ AmVec3f AmRayTracer::rayTracing(const AmRay &ray, const int depth)
     int minMesh = -1;
     
     //get the nearest hit point of the ray and the model
-    //float hit = getHitPoint(ray, minMesh);
-    float hit = kdtree.search(ray, minMesh);
-    
+    float hit = accel->search(ray, minMesh);
+    return shade(ray, hit, minMesh, depth);
+}
+
+// the color at the hit point of the ray, black if nothing is hit
+AmVec3f AmRayTracer::shade(const AmRay &ray, const float hit,
+                           const int minMesh, const int depth)
+{
+    AmVec3f color(0, 0, 0);
     if (hit > EPSILON) {
+        AmCounters::count(AmCounters::AM_HITS);
         /* get the intersection, calculate the color
          * Phong shading:
          * intensity = diffuse * (L.N) + specular * (V.R)^shinniness + ambient
@@ -101,6 +556,9 @@ AmVec3f AmRayTracer::rayTracing(const AmRay &ray, const int depth)
         AmVec3f pos = ray.orig + (ray.dir * hit);
         if (material->illum >= 3 && material->illum <= 7) {
             AmVec3f refl = getReflRayDir(ray.dir*(-1.0), model->mTriNorms[minMesh]);
+            if (depth > 1) {
+                AmCounters::count(AmCounters::AM_REFLECTION_RAYS);
+            }
             color = color + rayTracing(AmRay(pos, refl), depth-1);
         }
         
@@ -114,6 +572,9 @@ AmVec3f AmRayTracer::rayTracing(const AmRay &ray, const int depth)
                 pos = pos + ray.dir * 2 * EPSILON;
                 AmVec3f refr = getRefrRayDir(ray.dir,
                                         model->mTriNorms[minMesh], material);
+                if (depth > 1) {
+                    AmCounters::count(AmCounters::AM_REFRACTION_RAYS);
+                }
                 color = color + (rayTracing(AmRay(pos, refr), depth-1)
                                  * (1-material->transperancy));
             }
@@ -132,34 +593,6 @@ AmVec3f AmRayTracer::rayTracing(const AmRay &ray, const int depth)
 }
 
 
-// get the hit point of the ray and the model,
-// as well as the index of the mesh, return -1 if there is no intersection
-float AmRayTracer::getHitPoint(const AmRay &ray, int &index)
-{
-    // if not using kd-tree, iterate all the meshes
-    float mindis = -1;
-    bool hitOrNot = false;
-    for(unsigned int i = 0; i < model->mTriangles.size(); i++)
-    {
-        unsigned int * vindices = model->mTriangles[i].vindices;
-        float hit = hitMesh(ray, model->mVertices[vindices[0]],
-                            model->mVertices[vindices[1]],
-                            model->mVertices[vindices[2]]);
-
-        if(hit > EPSILON)
-        {
-            if(!hitOrNot || hit < mindis)
-            {
-                hitOrNot = true;
-                mindis = hit;
-                index = i;
-            }		
-        }
-    }
-    
-    return mindis;
-}
-
 // diffuse * (L.N)
 AmVec3f AmRayTracer::getDiffColor(const AmRay &shadowRay,
                                   const int index,
@@ -241,7 +674,9 @@ void AmRayTracer::shadowRay(const float hit, const int index,
         if (lights[i]->type != AmLight::AM_POSITION) {
             continue;
         }
-        AmLightPtr light = lights[i];
+        // a reference, copying the shared pointer would hit its atomic
+        //  reference count from every render thread
+        const AmLightPtr &light = lights[i];
         AmVec3f pos = ray.orig + (ray.dir * hit);//hit position
         AmVec3f dir = AmVec3f(light->value[0], light->value[1], light->value[2])
                         - pos;
@@ -250,11 +685,10 @@ void AmRayTracer::shadowRay(const float hit, const int index,
         dir.normalize();
         AmRay ray(pos, dir);
         
-        int hitMesh = -1;
-        //float hitAgain = getHitPoint(ray, hitMesh);//use kdtree instead
-        float hitAgain = kdtree.search(ray, hitMesh);
-        if (hitMesh != index && hitAgain > EPSILON && hitAgain < dis) {
-            // hit another mesh
+        AmCounters::count(AmCounters::AM_SHADOW_RAYS);
+        if (accel->occluded(ray, dis, index)) {
+            // another mesh is between the hit point and the light
+            AmCounters::count(AmCounters::AM_HITS);
             continue;
         }
         shadowRays.push_back(ray);
@@ -285,495 +719,3 @@ float AmRayTracer::hitMesh(const AmRay &ray, const AmVec3f &a,
     
 	return -1;		//no intersection
 }
-
-
-////////////// functions of kd-tree /////////////////////
-
-// init the root node of kd-tree and call to build the whole tree
-void AmKDTree::init()
-{
-    //clear exist data
-    nodes.clear();
-    
-    AmKDTreeNodePtr root(new AmKDTreeNode);
-    for (unsigned int i = 1; i < model->mTriangles.size(); i++) {
-        // start from index 1
-        root->meshes.push_back(i);
-    }
-    
-    AmVec3f vmax(M_MIN, M_MIN, M_MIN);
-    AmVec3f vmin(M_MAX, M_MAX, M_MAX);
-    for (unsigned int i = 1; i < model->mVertices.size(); i++) {
-        if (model->mVertices[i].x() > vmax.x()) {
-            vmax.setX(model->mVertices[i].x());
-        }
-        if (model->mVertices[i].y() > vmax.y()) {
-            vmax.setY(model->mVertices[i].y());
-        }
-        if (model->mVertices[i].z() > vmax.z()) {
-            vmax.setZ(model->mVertices[i].z());
-        }
-        if (model->mVertices[i].x() < vmin.x()) {
-            vmin.setX(model->mVertices[i].x());
-        }
-        if (model->mVertices[i].y() < vmin.y()) {
-            vmin.setY(model->mVertices[i].y());
-        }
-        if (model->mVertices[i].z() < vmin.z()) {
-            vmin.setZ(model->mVertices[i].z());
-        }
-    }
-    root->start = vmin;
-    root->end = vmax;
-    
-    nodes.push_back(root);
-    buildNode(0);
-}
-
-// depth-first search to build the tree
-void AmKDTree::buildNode(int index)
-{
-    while (index != -1) {
-        if (terminate(index)) {
-            nodes[index]->leaf = true;
-        } else {
-            splitNode(index);
-        }
-        
-        if (nodes[index]->leftChild != -1) {
-            index = nodes[index]->leftChild;
-            continue;
-        } else if (nodes[index]->sibling != -1) {
-            index = nodes[index]->sibling;
-            continue;
-        } else {
-            while (nodes[index]->parent != -1) {
-                index = nodes[index]->parent;
-                if (nodes[index]->sibling != -1) {
-                    index = nodes[index]->sibling;
-                    break;
-                }
-            }
-            if (nodes[index]->parent == -1) {
-                index = -1;
-            }
-        }
-    }
-}
-
-// check if need to terminate the splittion
-bool AmKDTree::terminate(int index)
-{
-    if(nodes[index]->depth == 16)
-	{// maximum depth of 16
-		return true;
-	}
-	if(nodes[index]->meshes.size() <= 5)
-    {// the number of meshes in the node is small enough
-		return true;
-	}
-    return false;
-}
-
-
-// split the node
-void AmKDTree::splitNode(int index)
-{
-    //first choose the plane to split
-    findPlane(index);
-    
-    //get the index of the children
-    nodes[index]->leftChild = static_cast<int>(nodes.size());
-    nodes.push_back(AmKDTreeNodePtr(new AmKDTreeNode));
-    nodes[index]->rightChild = static_cast<int>(nodes.size());
-    nodes.push_back(AmKDTreeNodePtr(new AmKDTreeNode));
-    
-    AmKDTreeNodePtr thenode = nodes[index];
-    AmKDTreeNodePtr left = nodes[thenode->leftChild];
-    AmKDTreeNodePtr right = nodes[thenode->rightChild];
-    
-    left->sibling = thenode->rightChild;
-    left->parent = right->parent = index;
-    left->depth = right->depth = thenode->depth + 1;
-	
-	left->start = thenode->start;
-    left->end = thenode->end;
-    right->start = thenode->start;
-    right->end = thenode->end;
-	if(thenode->plane.axis == AmPlane::AM_X)
-	{
-        left->end.mData[0] = right->start.mData[0] = thenode->plane.value;
-	} else if(thenode->plane.axis == AmPlane::AM_Y)
-	{
-        left->end.mData[1] = right->start.mData[1] = thenode->plane.value;
-	} else {
-        left->end.mData[2] = right->start.mData[2] = thenode->plane.value;
-	}
-    
-	// split the triangles
-	for(int i = 0; i < thenode->meshes.size(); i++)
-	{// check the triangles in parent node
-		int parentMesh = thenode->meshes[i];
-        
-		int position = meshInNode(parentMesh, thenode);
-		if(position <= 0)
-		{// in left child
-			left->meshes.push_back(parentMesh);
-		}
-        if (position >= 0)
-        {// in right child
-			right->meshes.push_back(parentMesh);
-		}
-	}
-}
-
-// find the plane to split the node
-//  first check if blank space is too large in one axis,
-//  if not, choose the axis of the largest span to split
-void AmKDTree::findPlane(int index)
-{
-    AmVec3f vmax(M_MIN, M_MIN, M_MIN);
-    AmVec3f vmin(M_MAX, M_MAX, M_MAX);
-    for (unsigned int i = 0; i < nodes[index]->meshes.size(); i++) {
-        AmVec3f start = model->mTriangles[nodes[index]->meshes[i]].start;
-        AmVec3f end = model->mTriangles[nodes[index]->meshes[i]].end;
-        if (end.x() > vmax.x()) {
-            vmax.setX(end.x());
-        }
-        if (end.y() > vmax.y()) {
-            vmax.setY(end.y());
-        }
-        if (end.z() > vmax.z()) {
-            vmax.setZ(end.z());
-        }
-        if (start.x() < vmin.x()) {
-            vmin.setX(start.x());
-        }
-        if (start.y() < vmin.y()) {
-            vmin.setY(start.y());
-        }
-        if (start.z() < vmin.z()) {
-            vmin.setZ(start.z());
-        }
-    }
-    float xspan = nodes[index]->end.x() - nodes[index]->start.x();
-	if((vmin.x() - nodes[index]->start.x()) / xspan > 0.25)
-	{// blank space of x axis from start is too much
-		nodes[index]->plane.axis = AmPlane::AM_X;
-		nodes[index]->plane.value = vmin.x();
-		return;
-	} else if((nodes[index]->end.x() - vmax.x()) / xspan > 0.25)
-	{// blank space of x axis from end is too much
-		nodes[index]->plane.axis = AmPlane::AM_X;
-		nodes[index]->plane.value = vmax.x();
-		return;
-	}
-    
-	float yspan = nodes[index]->end.y() - nodes[index]->start.y();
-	if((vmin.y() - nodes[index]->start.y()) / xspan > 0.25)
-	{// blank space of y axis from start is too much
-		nodes[index]->plane.axis = AmPlane::AM_Y;
-		nodes[index]->plane.value = vmin.y();
-		return;
-	} else if((nodes[index]->end.y() - vmax.y()) / yspan > 0.25)
-	{// blank space of y axis from end is too much
-		nodes[index]->plane.axis = AmPlane::AM_Y;
-		nodes[index]->plane.value = vmax.y();
-		return;
-	}
-    
-	float zspan = nodes[index]->end.z() - nodes[index]->start.z();
-	if((vmin.z() - nodes[index]->start.z()) / zspan > 0.25)
-	{// blank space of z axis from start is too much
-		nodes[index]->plane.axis = AmPlane::AM_Z;
-		nodes[index]->plane.value = vmin.z();
-		return;
-	} else if((nodes[index]->end.z() - vmax.z()) / zspan > 0.25)
-	{// blank space of z axis from end is too much
-		nodes[index]->plane.axis = AmPlane::AM_Z;
-		nodes[index]->plane.value = vmax.z();
-		return;
-	}
-    
-	// find the spacial median of the longest axis
-	if(xspan > yspan)
-	{
-		if(xspan > zspan)
-			nodes[index]->plane.axis = AmPlane::AM_X;
-		else
-			nodes[index]->plane.axis = AmPlane::AM_Z;
-	} else {
-		if(yspan > zspan)
-			nodes[index]->plane.axis = AmPlane::AM_Y;
-		else
-			nodes[index]->plane.axis = AmPlane::AM_Z;
-	}
-    
-	if(nodes[index]->plane.axis == AmPlane::AM_X)
-		nodes[index]->plane.value =
-            (nodes[index]->start.x() + nodes[index]->end.x()) * 0.5;
-	else if(nodes[index]->plane.axis == AmPlane::AM_Y)
-		nodes[index]->plane.value =
-            (nodes[index]->start.y() + nodes[index]->end.y()) * 0.5;
-	else
-		nodes[index]->plane.value =
-            (nodes[index]->start.z() + nodes[index]->end.z()) * 0.5;
-}
-
-// check what node the mesh is in
-// return -1 means left, 1 means right and 0 means both
-int AmKDTree::meshInNode(int mesh, const AmKDTreeNodePtr &node)
-{
-    float value = node->plane.value;
-    AmTriangle* m = &model->mTriangles[mesh];
-	if(node->plane.axis == AmPlane::AM_X)
-    {
-		if(m->end.x() < value-EPSILON)
-			return -1;
-		else if(m->start.x() > value+EPSILON)
-			return 1;
-		else
-			return 0;
-	} else if(node->plane.axis == AmPlane::AM_Y)
-	{
-		if(m->end.y() < value-EPSILON)
-			return -1;
-		else if(m->start.y() > value+EPSILON)
-			return 1;
-		else
-			return 0;
-	} else {
-		if(m->end.z() < value-EPSILON)
-			return -1;
-		else if(m->start.z() > value+EPSILON)
-			return 1;
-		else
-			return 0;
-	}
-}
-
-
-
-///// kd-tree traversal ///////
-
-// search for intersection
-float AmKDTree::search(const AmRay &ray, int &index)
-{
-    float hit = -1;
-    index = -1;
-    
-    // check the box intersection
-	float tmin, tmax;
-	if(!hitBox(0, ray, tmin, tmax))
-		return hit;
-    
-    
-	vector<int> stack;
-    vector<float> tstack;
-    int node = 0;
-	while(1)
-	{
-		if(nodes[node]->leaf)
-		{// hit the leaf
-			if(searchLeaf(node, ray, index, hit))
-				return hit;
-			else if(stack.size() > 0)
-			{//push node from stack
-				node = stack.back();stack.pop_back();
-                tmax = tstack.back();tstack.pop_back();
-                tmin = tstack.back();tstack.pop_back();
-			}
-			else
-				return hit;
-		} else {
-			float tHit;
-            
-			int first, second;  // the order of hit children
-            AmPlane::AmAxis axis = nodes[node]->plane.axis;
-            
-			if(axis == AmPlane::AM_X)
-			{
-				tHit = (nodes[node]->plane.value - ray.orig.x()) / ray.dir.x();
-				if(ray.dir.x() > 0)
-				{
-					first = nodes[node]->leftChild;
-					second = nodes[node]->rightChild;
-				} else {
-					second = nodes[node]->leftChild;
-					first = nodes[node]->rightChild;
-				}
-			} else if(axis == AmPlane::AM_Y)
-			{
-				tHit = (nodes[node]->plane.value - ray.orig.y()) / ray.dir.y();
-				if(ray.dir.y() > 0)
-				{
-					first = nodes[node]->leftChild;
-					second = nodes[node]->rightChild;
-				} else {
-					second = nodes[node]->leftChild;
-					first = nodes[node]->rightChild;
-				}
-			} else {
-				tHit = (nodes[node]->plane.value - ray.orig.z()) / ray.dir.z();
-				if(ray.dir.z() > 0)
-				{
-					first = nodes[node]->leftChild;
-					second = nodes[node]->rightChild;
-				}
-				else
-				{
-					second = nodes[node]->leftChild;
-					first = nodes[node]->rightChild;
-				}
-			}
-            
-			if(tHit > tmax+EPSILON)
-				node = first;
-			else if(tHit < tmin-EPSILON) //including the condition that tHit<0
-				node = second;
-			else
-			{ // through both children, push the second to stack
-                stack.push_back(second);
-                tstack.push_back(tHit);
-                tstack.push_back(tmax);
-				tmax = tHit;
-				node = first;
-			}
-		}
-	}
-	return hit;
-}
-
-
-// check if the ray hit the node
-bool AmKDTree::hitBox(int index, const AmRay &ray, float &tmin, float &tmax)
-{
-    AmKDTreeNodePtr thenode = nodes[index];
-    int init = 0;  //indicate whether tmin and tmax has been initialized
-    
-	// begin to check x axis
-	if(abs(ray.dir.x()) < EPSILON)
-	{// parallel to x axis
-		if(ray.orig.x() < thenode->start.x()
-           || ray.orig.x() > thenode->end.x())
-			return false;		//no intersection
-	} else {
-		float t1 = (thenode->start.x() - ray.orig.x()) / ray.dir.x();
-		float t2 = (thenode->end.x() - ray.orig.x()) / ray.dir.x();
-		
-		if(t1 > t2)
-		{// swap
-			float t = t1;
-			t1 = t2;
-			t2 = t;
-		}
-		
-		if(t2 < 0)
-			return false;	// the box is behind
-		
-		tmin = t1;
-		tmax = t2;
-		init = 1;
-	}
-	
-	// begin to check y axis
-	if(abs(ray.dir.y()) < EPSILON)
-	{// parallel to y axis
-		if(ray.orig.y() < thenode->start.y()
-           || ray.orig.y() > thenode->end.y())
-			return false;		//no intersection
-	} else {
-		float t1 = (thenode->start.y() - ray.orig.y()) / ray.dir.y();
-		float t2 = (thenode->end.y() - ray.orig.y()) / ray.dir.y();
-		
-		if(t1 > t2)
-		{// swap
-			float t = t1;
-			t1 = t2;
-			t2 = t;
-		}
-        
-		if(t2 < 0)
-			return false;	// the box is behind
-		
-		if(init == 1)
-		{
-			if(tmin < t1) tmin = t1;
-			if(tmax > t2) tmax = t2;
-			if(tmax - tmin < -EPSILON) return false;
-		} else {
-			tmin = t1;
-			tmax = t2;
-			init = 1;
-		}
-	}
-    
-	// begin to check z axis
-	if(abs(ray.dir.z()) < EPSILON)
-	{// parallel to y axis
-		if(ray.orig.z() < thenode->start.z()
-           || ray.orig.z() > thenode->end.z())
-			return false;		//no intersection
-	} else {
-		float t1 = (thenode->start.z() - ray.orig.z()) / ray.dir.z();
-		float t2 = (thenode->end.z() - ray.orig.z()) / ray.dir.z();
-        
-		if(t1 > t2)
-		{// swap
-			float t = t1;
-			t1 = t2;
-			t2 = t;
-		}
-        
-		if(t2 < 0)
-			return false;	// the box is behind
-        
-		if(init == 1)
-		{
-			if(tmin < t1) tmin = t1;
-			if(tmax > t2) tmax = t2;
-			if(tmax - tmin < -EPSILON) return false;
-		}
-		else
-		{
-			tmin = t1;
-			tmax = t2;
-		}	
-	}
-	
-	return true;
-}
-
-bool AmKDTree::searchLeaf(int node, const AmRay &ray, int &index, float &minHit)
-{
-    index = -1;
-    minHit = -1;
-	bool hitOrNot = false;
-	for(int i = 0; i < nodes[node]->meshes.size(); i++)
-	{
-		int j = nodes[node]->meshes[i];
-		unsigned int *vindices = model->mTriangles[j].vindices;
-		float hit = AmRayTracer::hitMesh(ray, model->mVertices[vindices[0]],
-								model->mVertices[vindices[1]],
-								model->mVertices[vindices[2]]);
-        
-		if(hit > EPSILON)
-		{
-			if(!hitOrNot)
-			{
-				minHit = hit;
-				index = j;
-				hitOrNot = true;
-			}
-			else
-			{
-				if(hit < minHit)
-				{
-					minHit = hit;
-					index = j;
-				}
-			}
-		}
-	}
-    return hitOrNot;
-}
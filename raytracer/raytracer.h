@@ -10,6 +10,11 @@
 #define raytracer_raytracer_h
 
 #include "utils.h"
+#include "threadpool.h"
+#include "accel.h"
+#include "kdtree.h"
+#include "bvh.h"
+#include "stats.h"
 
 using namespace std;
 
@@ -17,164 +22,237 @@ namespace raytracer {
     
     
     /*
-     * ray info
+     * the primary ray of a pixel kept for the reprojection: the point it
+     *  hit and the color of the pixel, or its direction if it hit nothing
      */
-    class AmRay
+    class AmPixelSample
     {
     public:
-        AmVec3f orig;
-        AmVec3f dir;
-        
-        AmRay(const AmVec3f &o, const AmVec3f &d)
-            :orig(o), dir(d)
-        {}
-        
-        AmRay(const AmCameraPtr &camera, int w, int h);
-        
-        bool operator == (AmRay &rhs)
+        enum AmState
         {
-            return (orig == rhs.orig && dir == rhs.dir);
-        }
+            AM_EMPTY,
+            AM_HIT,
+            AM_MISS
+        };
         
-    };
-    
-    /*
-     * space plane for kd-tree
-     */
-    class AmPlane
-    {
-    public:
-        enum AmAxis{AM_X, AM_Y, AM_Z};
-        
-        AmAxis  axis;
-        float   value;
-        int     index;
+        AmVec3f         point;
+        unsigned int    color;
+        AmState         state;
         
-        AmPlane()
-        :axis(AM_X), value(0), index(0)
+        AmPixelSample()
+            :color(0), state(AM_EMPTY)
         {}
     };
     
-    
     /*
-     * kd-tree node
+     * the class that implements ray tracing algorithm
      */
-    class AmKDTreeNode
+    class AmRayTracer
     {
+        AmModelPtr      model;
+        AmCameraPtr     camera;
+        vector<AmLightPtr> lights;
+        int             maxDepth;
+        
+        AmAcceleratorPtr        accel;
+        AmAccelerator::AmType   accelType;
+        AmKDTree::AmHeuristic   kdHeuristic;
+        
+        int             threads;    // number of render threads
+        int             tileSize;   // width and height of a render tile
+        int             packetSize; // primary rays traced as packets of
+                                    //  packetSize x packetSize, 1 for none
+        AmThreadPoolPtr pool;
+        string          cacheDir;   // of the kd-trees, empty for no cache
+        
+        int             samples;    // most rays per antialiased pixel
+        float           contrast;   // color difference that antialiases
+        long            refined;    // pixels antialiased by the last render
+        vector<int>     primary;    // triangle hit in each pixel, -1 for none
+        vector<unsigned char> edges;   // pixels to antialias
+        
+        bool            reprojection;  // keep the samples of the pixels
+        vector<AmPixelSample> samplesKept;
+        long            traced;     // pixels traced by the last reproject
+        
+        vector<AmCounters> slots;   // of the render threads
+        AmStats         stats;
+        
     public:
-        int     parent;         // index of the parent in tree node vector
-        int     leftChild;      // index of left child
-        int     rightChild;     // index of right child
-        int     sibling;        // index of sibling
+        AmRayTracer()
+            :maxDepth(3), accelType(AmAccelerator::AM_KDTREE),
+            kdHeuristic(AmKDTree::AM_MEDIAN), threads(1), tileSize(16),
+            packetSize(4), samples(1), contrast(0.1f), refined(0),
+            reprojection(false), traced(0)
+        {}
+     
+        AmRayTracer(const AmModelPtr &m)
+            :maxDepth(3), accelType(AmAccelerator::AM_KDTREE),
+            kdHeuristic(AmKDTree::AM_MEDIAN), threads(1), tileSize(16),
+            packetSize(4), samples(1), contrast(0.1f), refined(0),
+            reprojection(false), traced(0)
+        {
+            setModel(m);
+        }
         
-        bool    leaf;           // is leaf or not
-        int     depth;
-        AmVec3f start;          // start of bounding box
-        AmVec3f end;            // end of bounding box
+        // set the model and build the acceleration structure for it
+        void setModel(const AmModelPtr &m);
+     
+        void setCamera(const AmCameraPtr &c)
+        {
+            camera = c;
+        }
         
-        AmPlane plane;
-        vector<int> meshes;     //the indices of meshes in this node
+        void setLight(const vector<AmLightPtr> l)
+        {
+            lights = vector<AmLightPtr>(l);
+        }
         
-        AmKDTreeNode()
-        :start(0,0,0), end(0,0,0)
+        void setMaxDepth(int d)
         {
-            parent = leftChild = rightChild = sibling = -1;
-            leaf = false;
-            depth = 0;
+            maxDepth = d;
         }
-    };
-    typedef shared_ptr<AmKDTreeNode> AmKDTreeNodePtr;
-    
-    
-    /*
-     * kd-tree to accelerate the tracing
-     */
-    class AmKDTree
-    {
-    private:
-        AmModelPtr  model;
         
-    public:
-        vector<AmKDTreeNodePtr>    nodes;
+        // choose the acceleration structure, takes effect on the next
+        //  setModel
+        void setAccelerator(AmAccelerator::AmType t)
+        {
+            accelType = t;
+        }
         
-        AmKDTree()
-        {}
+        // choose the kd-tree builder, takes effect on the next setModel
+        void setKDTreeHeuristic(AmKDTree::AmHeuristic h)
+        {
+            kdHeuristic = h;
+        }
         
-        AmKDTree(const AmModelPtr &m)
-        :model(m)
-        {}
+        // keep the built kd-trees in the directory and load them from
+        //  there when the same model is set again, empty to disable
+        void setCacheDir(const string &dir)
+        {
+            cacheDir = dir;
+        }
+        
+        // number of threads used by render, 0 means all hardware threads
+        void setThreads(int n);
         
-        void setModel(const AmModelPtr &m)
+        void setTileSize(int s)
         {
-            model = m;
+            tileSize = max(s, 1);
         }
         
-        void    init();               // build the kdtree from the model;
-        float   search(const AmRay &ray, int &index); //search for intersection
+        // 1, 2 (2x2 rays) or 4 (4x4 rays)
+        void setPacketSize(int s)
+        {
+            packetSize = (s >= 4) ? 4 : max(s, 1);
+        }
         
-    private:
-        void buildNode(int index); // build from the node
-        bool terminate(int index);
-        void splitNode(int index);
-        void findPlane(int index);
-        int  meshInNode(int mesh, const AmKDTreeNodePtr &node);
+        // adaptive antialiasing: the pixels whose color or triangle differ
+        //  from a neighbour get up to s rays on a stratified grid, rounded
+        //  down to a square (4 is 2x2, 16 is 4x4), 1 for none
+        void setSamples(int s)
+        {
+            int n = static_cast<int>(sqrt(static_cast<float>(max(s, 1))));
+            samples = n * n;
+        }
         
-        bool hitBox(int index, const AmRay &ray, float &tmin, float &tmax);
-        bool searchLeaf(int node, const AmRay &ray, int &index, float &hit);
+        // difference of a color channel in [0, 1] that counts as an edge
+        void setContrast(float c)
+        {
+            contrast = c;
+        }
         
-    };
-    
-    
-    /*
-     * the class that implements ray tracing algorithm
-     */
-    class AmRayTracer
-    {
-        AmModelPtr      model;
-        AmCameraPtr     camera;
-        vector<AmLightPtr> lights;
-        int             maxDepth;
+        // number of pixels antialiased by the last render
+        long getRefined() const
+        {
+            return refined;
+        }
         
-        AmKDTree        kdtree;
+        // keep the hit point and color of every pixel that render and
+        //  renderStride trace, for reproject
+        void setReprojection(bool r)
+        {
+            reprojection = r;
+            samplesKept.clear();
+        }
         
-    public:
-        AmRayTracer()
-            :maxDepth(3)
-        {}
-     
-        AmRayTracer(const AmModelPtr &m)
-            :maxDepth(3), model(m), kdtree(m)
+        // number of pixels traced again by the last reproject
+        long getTraced() const
         {
-            kdtree.init();
+            return traced;
         }
         
-        void setModel(const AmModelPtr &m)
+        // the counters and phase times since the last resetStats, the
+        //  counters of the threads are merged after every render call
+        const AmStats &getStats() const
         {
-            model = m;
-            kdtree.setModel(m);
-            kdtree.init();
+            return stats;
         }
-     
-        void setCamera(const AmCameraPtr &c)
+        
+        void resetStats()
         {
-            camera = c;
+            stats.clear();
         }
         
-        void setLight(const vector<AmLightPtr> l)
+        const AmAcceleratorPtr &getAccelerator() const
         {
-            lights = vector<AmLightPtr>(l);
+            return accel;
         }
         
         // render the model with the camera, put the result into buffer
         void render(AmUintPtr &pixels);
         
+        // progressive rendering: trace one ray per stride x stride block
+        //  of the rows [y0, y1) and fill the block with its color. Passes
+        //  of stride COARSE_STRIDE, ..., 2, 1 refine the frame, the blocks
+        //  already traced by the pass of stride * 2 are not traced again
+        static const int COARSE_STRIDE = 4;
+        void renderStride(AmUintPtr &pixels, int stride, int y0, int y1);
+        
+        // render after the camera moved: warp the kept samples into the
+        //  new camera and trace only the pixels no sample lands on or
+        //  whose sample is much farther than a neighbour. Renders the
+        //  whole frame if nothing is kept for this size
+        void reproject(AmUintPtr &pixels);
+        
         // static function to get the intersection of a ray and mesh
         static float hitMesh(const AmRay &ray, const AmVec3f &a,
                              const AmVec3f &b, const AmVec3f &c);
         
+        // direction of the ray reflected about the normal N, D points
+        //  away from the surface
+        static AmVec3f getReflRayDir(const AmVec3f &D, const AmVec3f &N);
+        
+        // direction of the ray D refracted through the surface of normal
+        //  N into the material
+        static AmVec3f getRefrRayDir(const AmVec3f &D, const AmVec3f &N,
+                                     const AmMaterial *material);
+        
     private:
+        void    setModelAccel(const AmModelPtr &m);
+        
+        typedef function<void(int, int, int, int)> AmTileFunc;
+        // split the rows [y0, y1) into tiles and run f on each of them,
+        //  add the counts of the threads and the time to the phase
+        void    runTiles(AmStats::AmPhase phase, int y0, int y1, int align, const AmTileFunc &f);
+        void    renderTile(unsigned int *pixels, int *prims,
+                           int x0, int y0, int x1, int y1);
+        void    antialias(unsigned int *pixels);
+        void    antialiasTile(unsigned int *pixels, int x0, int y0,
+                              int x1, int y1);
+        void    renderTileStride(unsigned int *pixels, int stride,
+                                 int x0, int y0, int x1, int y1);
+        void    keepSample(int idx, const AmRay &ray, float hit,
+                           unsigned int pixel);
+        bool    keeping() const
+        {
+            return reprojection && !samplesKept.empty();
+        }
         AmVec3f rayTracing(const AmRay &ray, const int depth);
-        float   getHitPoint(const AmRay &ray, int &index);
+        AmVec3f primaryRay(const AmRay &ray, float &hit, int &minMesh);
+        // color of the hit of the ray
+        AmVec3f shade(const AmRay &ray, const float hit, const int minMesh,
+                      const int depth);
         
         void    shadowRay(const float hit, const int index,
                           const AmRay &ray, vector<AmRay> &shadowRays);
@@ -183,14 +261,10 @@ namespace raytracer {
                              const int index,
                              const AmMaterial *material);
         
-        AmVec3f getReflRayDir(const AmVec3f &D, const AmVec3f &N);
         AmVec3f getReflColor(const AmRay &ray,
                              const AmRay &shadowRay,
                              const int index,
                              const AmMaterial *material);
-        
-        AmVec3f getRefrRayDir(const AmVec3f &D, const AmVec3f &N,
-                              const AmMaterial *material);
     };
 
 
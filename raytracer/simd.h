@@ -0,0 +1,131 @@
+//
+//  simd.h
+//  raytracer
+//
+//  thin wrappers of the SSE and AVX2 intrinsics used by the kernels that
+//  test several triangles at once. AM_SIMD_WIDTH is the number of lanes:
+//  8 when compiled with AVX2 (-mavx2), 4 with SSE2 (any x86-64 build),
+//  1 otherwise, in which case the callers use their scalar code.
+//
+//  Created by ambling on 13-5-25.
+//  Copyright (c) 2013年 ambling. All rights reserved.
+//
+
+#ifndef raytracer_simd_h
+#define raytracer_simd_h
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define AM_SIMD_WIDTH 8
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define AM_SIMD_WIDTH 4
+#else
+#define AM_SIMD_WIDTH 1
+#endif
+
+namespace raytracer {
+
+#if AM_SIMD_WIDTH == 8
+
+    typedef __m256 AmFloatV;
+
+    inline AmFloatV vLoad(const float *p)   { return _mm256_loadu_ps(p); }
+    inline AmFloatV vSet1(float f)          { return _mm256_set1_ps(f); }
+    inline AmFloatV vAdd(AmFloatV a, AmFloatV b) { return _mm256_add_ps(a, b); }
+    inline AmFloatV vSub(AmFloatV a, AmFloatV b) { return _mm256_sub_ps(a, b); }
+    inline AmFloatV vMul(AmFloatV a, AmFloatV b) { return _mm256_mul_ps(a, b); }
+    inline AmFloatV vDiv(AmFloatV a, AmFloatV b) { return _mm256_div_ps(a, b); }
+    inline AmFloatV vMin(AmFloatV a, AmFloatV b) { return _mm256_min_ps(a, b); }
+    inline AmFloatV vMax(AmFloatV a, AmFloatV b) { return _mm256_max_ps(a, b); }
+    inline AmFloatV vAnd(AmFloatV a, AmFloatV b) { return _mm256_and_ps(a, b); }
+    inline AmFloatV vOr(AmFloatV a, AmFloatV b)  { return _mm256_or_ps(a, b); }
+    // (not a) and b
+    inline AmFloatV vAndNot(AmFloatV a, AmFloatV b)
+    { return _mm256_andnot_ps(a, b); }
+    // the bits of an int in every lane, to carry indices through vSelect
+    inline AmFloatV vSet1i(int i)
+    { return _mm256_castsi256_ps(_mm256_set1_epi32(i)); }
+    inline void vStore(float *p, AmFloatV a) { _mm256_storeu_ps(p, a); }
+    inline AmFloatV vLT(AmFloatV a, AmFloatV b)
+    { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    inline AmFloatV vLE(AmFloatV a, AmFloatV b)
+    { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    inline AmFloatV vGT(AmFloatV a, AmFloatV b)
+    { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    inline AmFloatV vGE(AmFloatV a, AmFloatV b)
+    { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    inline AmFloatV vEQ(AmFloatV a, AmFloatV b)
+    { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+    inline AmFloatV vNE(AmFloatV a, AmFloatV b)
+    { return _mm256_cmp_ps(a, b, _CMP_NEQ_UQ); }
+    // a where mask is set, b elsewhere
+    inline AmFloatV vSelect(AmFloatV mask, AmFloatV a, AmFloatV b)
+    { return _mm256_blendv_ps(b, a, mask); }
+    inline int vMask(AmFloatV a)            { return _mm256_movemask_ps(a); }
+
+    // smallest lane, in every lane
+    inline AmFloatV vHMin(AmFloatV a)
+    {
+        a = _mm256_min_ps(a, _mm256_permute2f128_ps(a, a, 1));
+        a = _mm256_min_ps(a, _mm256_shuffle_ps(a, a, _MM_SHUFFLE(1, 0, 3, 2)));
+        return _mm256_min_ps(a, _mm256_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)));
+    }
+    inline float vFirst(AmFloatV a)         { return _mm256_cvtss_f32(a); }
+
+#elif AM_SIMD_WIDTH == 4
+
+    typedef __m128 AmFloatV;
+
+    inline AmFloatV vLoad(const float *p)   { return _mm_loadu_ps(p); }
+    inline AmFloatV vSet1(float f)          { return _mm_set1_ps(f); }
+    inline AmFloatV vAdd(AmFloatV a, AmFloatV b) { return _mm_add_ps(a, b); }
+    inline AmFloatV vSub(AmFloatV a, AmFloatV b) { return _mm_sub_ps(a, b); }
+    inline AmFloatV vMul(AmFloatV a, AmFloatV b) { return _mm_mul_ps(a, b); }
+    inline AmFloatV vDiv(AmFloatV a, AmFloatV b) { return _mm_div_ps(a, b); }
+    inline AmFloatV vMin(AmFloatV a, AmFloatV b) { return _mm_min_ps(a, b); }
+    inline AmFloatV vMax(AmFloatV a, AmFloatV b) { return _mm_max_ps(a, b); }
+    inline AmFloatV vAnd(AmFloatV a, AmFloatV b) { return _mm_and_ps(a, b); }
+    inline AmFloatV vOr(AmFloatV a, AmFloatV b)  { return _mm_or_ps(a, b); }
+    // (not a) and b
+    inline AmFloatV vAndNot(AmFloatV a, AmFloatV b)
+    { return _mm_andnot_ps(a, b); }
+    // the bits of an int in every lane, to carry indices through vSelect
+    inline AmFloatV vSet1i(int i)
+    { return _mm_castsi128_ps(_mm_set1_epi32(i)); }
+    inline void vStore(float *p, AmFloatV a) { _mm_storeu_ps(p, a); }
+    inline AmFloatV vLT(AmFloatV a, AmFloatV b)  { return _mm_cmplt_ps(a, b); }
+    inline AmFloatV vLE(AmFloatV a, AmFloatV b)  { return _mm_cmple_ps(a, b); }
+    inline AmFloatV vGT(AmFloatV a, AmFloatV b)  { return _mm_cmpgt_ps(a, b); }
+    inline AmFloatV vGE(AmFloatV a, AmFloatV b)  { return _mm_cmpge_ps(a, b); }
+    inline AmFloatV vEQ(AmFloatV a, AmFloatV b)  { return _mm_cmpeq_ps(a, b); }
+    inline AmFloatV vNE(AmFloatV a, AmFloatV b)  { return _mm_cmpneq_ps(a, b); }
+    // a where mask is set, b elsewhere (SSE2 has no blendv)
+    inline AmFloatV vSelect(AmFloatV mask, AmFloatV a, AmFloatV b)
+    { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+    inline int vMask(AmFloatV a)            { return _mm_movemask_ps(a); }
+
+    // smallest lane, in every lane
+    inline AmFloatV vHMin(AmFloatV a)
+    {
+        a = _mm_min_ps(a, _mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 0, 3, 2)));
+        return _mm_min_ps(a, _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)));
+    }
+    inline float vFirst(AmFloatV a)         { return _mm_cvtss_f32(a); }
+
+#endif
+
+    // index of the lowest set bit of a lane mask
+    inline int vFirstLane(int mask)
+    {
+        int lane = 0;
+        while (!(mask & 1)) {
+            mask >>= 1;
+            lane++;
+        }
+        return lane;
+    }
+
+}
+
+#endif
@@ -0,0 +1,192 @@
+//
+//  stats.h
+//  raytracer
+//
+//  counters of the ray tracing: every render thread counts into a slot
+//  of its own, the raytracer merges the slots into AmStats after each
+//  render call, so the threads never write to a shared line
+//
+//  Created by ambling on 13-6-2.
+//  Copyright (c) 2013年 ambling. All rights reserved.
+//
+
+#ifndef raytracer_stats_h
+#define raytracer_stats_h
+
+#include "utils.h"
+
+using namespace std;
+
+namespace raytracer {
+
+    /*
+     * the counters of one thread
+     */
+    class AmCounters
+    {
+    public:
+        enum AmCounter
+        {
+            AM_PRIMARY_RAYS,
+            AM_SHADOW_RAYS,
+            AM_REFLECTION_RAYS,
+            AM_REFRACTION_RAYS,
+            AM_NODES,           // inner nodes visited by the traversals
+            AM_LEAVES,          // leaves visited by the traversals
+            AM_TRIANGLE_TESTS,
+            AM_HITS,            // rays that hit a triangle
+            AM_COUNTERS
+        };
+
+        unsigned long long value[AM_COUNTERS];
+
+    private:
+        char pad[64];   // keeps the slots of two threads off a cache line
+
+    public:
+        AmCounters()
+        {
+            clear();
+        }
+
+        void clear()
+        {
+            for (int i = 0; i < AM_COUNTERS; i++) {
+                value[i] = 0;
+            }
+        }
+
+        void merge(const AmCounters &rhs)
+        {
+            for (int i = 0; i < AM_COUNTERS; i++) {
+                value[i] += rhs.value[i];
+            }
+        }
+
+        unsigned long long rays() const
+        {
+            return value[AM_PRIMARY_RAYS] + value[AM_SHADOW_RAYS]
+                + value[AM_REFLECTION_RAYS] + value[AM_REFRACTION_RAYS];
+        }
+
+        static const char *name(int counter)
+        {
+            static const char *names[AM_COUNTERS] = {
+                "primary rays", "shadow rays", "reflection rays",
+                "refraction rays", "nodes", "leaves", "triangle tests", "hits"
+            };
+            return names[counter];
+        }
+
+        // the slot of the calling thread, null when it isn't counting
+        static AmCounters *&current()
+        {
+            static thread_local AmCounters *slot = 0;
+            return slot;
+        }
+
+        static void count(AmCounter counter, unsigned long long n = 1)
+        {
+            AmCounters *slot = current();
+            if (slot) {
+                slot->value[counter] += n;
+            }
+        }
+    };
+
+    /*
+     * the counts of one traversal, kept in registers while it runs and
+     *  added to the slot of the thread when it goes out of scope
+     */
+    class AmTraversalCounts
+    {
+    public:
+        unsigned int nodes;
+        unsigned int leaves;
+        unsigned int tests;
+
+        AmTraversalCounts()
+            :nodes(0), leaves(0), tests(0)
+        {}
+
+        ~AmTraversalCounts()
+        {
+            AmCounters *slot = AmCounters::current();
+            if (slot) {
+                slot->value[AmCounters::AM_NODES] += nodes;
+                slot->value[AmCounters::AM_LEAVES] += leaves;
+                slot->value[AmCounters::AM_TRIANGLE_TESTS] += tests;
+            }
+        }
+    };
+
+    /*
+     * the merged counters and the wall time of the phases since the
+     *  last clear
+     */
+    class AmStats
+    {
+    public:
+        enum AmPhase
+        {
+            AM_BUILD,       // setModel
+            AM_TRACE,       // render, renderStride and the holes of reproject
+            AM_ANTIALIAS,   // finding the edges and supersampling them
+            AM_REPROJECT,   // warping the kept samples
+            AM_PHASES
+        };
+
+        AmCounters  counters;
+        double      times[AM_PHASES];   // seconds
+
+        AmStats()
+        {
+            clear();
+        }
+
+        void clear()
+        {
+            counters.clear();
+            for (int i = 0; i < AM_PHASES; i++) {
+                times[i] = 0;
+            }
+        }
+
+        double time() const
+        {
+            double sum = 0;
+            for (int i = 0; i < AM_PHASES; i++) {
+                sum += times[i];
+            }
+            return sum;
+        }
+
+        static const char *name(int phase)
+        {
+            static const char *names[AM_PHASES] = {
+                "build", "trace", "antialias", "reproject"
+            };
+            return names[phase];
+        }
+
+        // one line per counter and phase
+        void report(ostream &os) const
+        {
+            for (int i = 0; i < AmCounters::AM_COUNTERS; i++) {
+                os<<"stats: "<<AmCounters::name(i)<<" "
+                    <<counters.value[i]<<endl;
+            }
+            for (int i = 0; i < AM_PHASES; i++) {
+                os<<"stats: "<<name(i)<<" time "<<times[i]<<" s"<<endl;
+            }
+            double t = times[AM_TRACE] + times[AM_ANTIALIAS]
+                        + times[AM_REPROJECT];
+            if (t > 0) {
+                os<<"stats: "<<counters.rays() / t / 1e6<<" Mrays/s"<<endl;
+            }
+        }
+    };
+
+}
+
+#endif
@@ -0,0 +1,125 @@
+//
+//  threadpool.cpp
+//  raytracer
+//
+//  Created by ambling on 13-5-12.
+//  Copyright (c) 2013年 ambling. All rights reserved.
+//
+
+#include "threadpool.h"
+
+using namespace std;
+using namespace raytracer;
+
+
+// start n workers, each of them with an empty queue
+AmThreadPool::AmThreadPool(int n)
+    :pending(0), batch(0), quit(false)
+{
+    if (n < 1) {
+        n = 1;
+    }
+    for (int i = 0; i < n; i++) {
+        queues.push_back(shared_ptr<AmWorkerQueue>(new AmWorkerQueue));
+    }
+    for (int i = 0; i < n; i++) {
+        workers.push_back(thread(&AmThreadPool::work, this, i));
+    }
+}
+
+// stop all the workers
+AmThreadPool::~AmThreadPool()
+{
+    {
+        unique_lock<mutex> guard(poolLock);
+        quit = true;
+    }
+    wakeUp.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+int AmThreadPool::hardwareThreads()
+{
+    int n = static_cast<int>(thread::hardware_concurrency());
+    return max(n, 1);
+}
+
+// deal the tasks round-robin to the queues, then wake the workers
+//  and block until every task has been done
+void AmThreadPool::run(vector<AmTask> &tasks)
+{
+    if (tasks.empty()) {
+        return;
+    }
+
+    for (size_t i = 0; i < tasks.size(); i++) {
+        AmWorkerQueue *queue = queues[i % queues.size()].get();
+        unique_lock<mutex> guard(queue->lock);
+        queue->tasks.push_back(tasks[i]);
+    }
+
+    unique_lock<mutex> guard(poolLock);
+    pending += static_cast<int>(tasks.size());
+    batch++;
+    wakeUp.notify_all();
+    while (pending > 0) {
+        allDone.wait(guard);
+    }
+}
+
+// take a task from the back of its own queue,
+//  or steal one from the front of the others
+bool AmThreadPool::takeTask(int index, AmTask &task)
+{
+    {
+        AmWorkerQueue *own = queues[index].get();
+        unique_lock<mutex> guard(own->lock);
+        if (!own->tasks.empty()) {
+            task = own->tasks.back();
+            own->tasks.pop_back();
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < queues.size(); i++) {
+        AmWorkerQueue *victim = queues[(index + i) % queues.size()].get();
+        unique_lock<mutex> guard(victim->lock);
+        if (!victim->tasks.empty()) {
+            task = victim->tasks.front();
+            victim->tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+// main loop of a worker
+void AmThreadPool::work(int index)
+{
+    unsigned long seen = 0;
+    while (1) {
+        {
+            unique_lock<mutex> guard(poolLock);
+            while (!quit && batch == seen) {
+                wakeUp.wait(guard);
+            }
+            if (quit) {
+                return;
+            }
+            seen = batch;
+        }
+
+        AmTask task;
+        while (takeTask(index, task)) {
+            task(index);
+
+            unique_lock<mutex> guard(poolLock);
+            pending--;
+            if (pending == 0) {
+                allDone.notify_all();
+            }
+        }
+    }
+}
@@ -0,0 +1,77 @@
+//
+//  threadpool.h
+//  raytracer
+//
+//  Created by ambling on 13-5-12.
+//  Copyright (c) 2013年 ambling. All rights reserved.
+//
+
+#ifndef raytracer_threadpool_h
+#define raytracer_threadpool_h
+
+#include "utils.h"
+
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+namespace raytracer {
+
+    /*
+     * work-stealing thread pool,
+     *  every worker owns a deque of tasks, takes tasks from its back and
+     *  steals from the front of the other deques when its own one is empty
+     */
+    class AmThreadPool
+    {
+    public:
+        // a task gets the index of the worker that runs it
+        typedef function<void(int)> AmTask;
+
+    private:
+        class AmWorkerQueue
+        {
+        public:
+            mutex           lock;
+            deque<AmTask>   tasks;
+        };
+
+        vector<thread>                  workers;
+        vector<shared_ptr<AmWorkerQueue> > queues;
+
+        mutex               poolLock;
+        condition_variable  wakeUp;     // new tasks or quit
+        condition_variable  allDone;    // pending drops to 0
+        int                 pending;    // tasks not finished yet
+        unsigned long       batch;      // counter of run() calls
+        bool                quit;
+
+    public:
+        AmThreadPool(int n);
+        ~AmThreadPool();
+
+        int size() const
+        {
+            return static_cast<int>(queues.size());
+        }
+
+        // distribute the tasks to the workers and wait for all of them
+        void run(vector<AmTask> &tasks);
+
+        // number of hardware threads, at least 1
+        static int hardwareThreads();
+
+    private:
+        void work(int index);
+        bool takeTask(int index, AmTask &task);
+    };
+    typedef shared_ptr<AmThreadPool> AmThreadPoolPtr;
+
+}
+
+
+#endif
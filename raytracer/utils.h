@@ -16,6 +16,7 @@
 #include <cmath>
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 
 #ifdef _LIBCPP_VERSION
 #include <memory>
@@ -242,6 +243,44 @@ namespace raytracer {
                 return "";
             }
         }
+        
+        // 64 bit FNV-1a hash of the bytes, chain calls by passing the
+        //  previous result as hash
+        static unsigned long long hashFNV(const void *data, size_t n,
+                            unsigned long long hash = 14695981039346656037ULL)
+        {
+            const unsigned char *bytes = static_cast<const unsigned char *>(data);
+            for (size_t i = 0; i < n; i++) {
+                hash = (hash ^ bytes[i]) * 1099511628211ULL;
+            }
+            return hash;
+        }
+    };
+    
+    
+    /*
+     * wall clock timer
+     */
+    class AmTimer
+    {
+        chrono::steady_clock::time_point begin;
+        
+    public:
+        AmTimer()
+            :begin(chrono::steady_clock::now())
+        {}
+        
+        void reset()
+        {
+            begin = chrono::steady_clock::now();
+        }
+        
+        // seconds since construction or the last reset
+        double elapsed() const
+        {
+            return chrono::duration<double>(chrono::steady_clock::now()
+                                            - begin).count();
+        }
     };
     
     